@@ -0,0 +1,31 @@
+(setq keep nil)
+(setq i 0)
+(tagbody
+ small
+   (if (< i 300000)
+       (progn
+	 (if (= (mod i 3) 0)
+	     (setq keep (cons (makei (+ 1 (mod i 61)) 3) keep))
+	     (makei (+ 1 (mod i 61)) 3))
+	 (cons i (* i 1.5))
+	 (setq i (+ i 1))
+	 (go small))))
+(gc)
+(setq i 0)
+(tagbody
+ large
+   (if (< i 3000)
+       (progn
+	 (makei (+ 1000 (mod (* i 7) 4000)) 3)
+	 (setq i (+ i 1))
+	 (go large))))
+(setq i 0)
+(tagbody
+ again
+   (if (< i 300000)
+       (progn
+	 (makei (+ 1 (mod i 61)) 3)
+	 (cons i (* i 1.5))
+	 (setq i (+ i 1))
+	 (go again))))
+(print (length keep))
@@ -0,0 +1,32 @@
+(defun factorial (n)
+  (let ((r 1)
+	(i 1))
+    (tagbody
+     top
+       (if (< n i)
+	   nil
+	   (progn
+	     (setq r (* r i))
+	     (setq i (+ i 1))
+	     (go top))))
+    r))
+(defun fibonacci (n)
+  (let ((a 0)
+	(b 1)
+	(c 0)
+	(i 0))
+    (tagbody
+     top
+       (if (< i n)
+	   (progn
+	     (setq c (+ a b))
+	     (setq a b)
+	     (setq b c)
+	     (setq i (+ i 1))
+	     (go top))))
+    a))
+(setq f (factorial 3000))
+(print (mod f 1000000007))
+(print (mod (* f f) 1000000007))
+(print (mod (fibonacci 20000) 1000000007))
+(print (factorial 1000))
@@ -0,0 +1,15 @@
+#!/bin/bash
+# Times reading two quoted lists of the same N (200000) new symbols.
+# Usage, from lisp801/: bench/intern.sh [binary]
+n=${N:-200000}
+f=${TMPDIR:-/tmp}/intern801.lisp
+awk -v n=$n 'BEGIN {
+    for (k = 0; k < 2; k++) {
+        printf "(quote (";
+        for (i = 0; i < n; i++)
+            printf " sym%d", i;
+        print "))";
+    }
+}' > $f
+time ${1:-./lisp801} small.lisp $f < /dev/null > /dev/null
+rm -f $f
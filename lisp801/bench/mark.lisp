@@ -0,0 +1,27 @@
+(setq deep nil)
+(setq i 0)
+(tagbody
+ top
+   (if (< i 1000000)
+       (progn
+	 (setq deep (cons deep i))
+	 (setq i (+ i 1))
+	 (go top))))
+(setq vectors nil)
+(setq i 0)
+(tagbody
+ top
+   (if (< i 300000)
+       (progn
+	 (setq vectors (cons (makei 2 3 i (makei 1 3 vectors)) vectors))
+	 (setq i (+ i 1))
+	 (go top))))
+(setq i 0)
+(tagbody
+ top
+   (if (< i 10)
+       (progn
+	 (gc)
+	 (setq i (+ i 1))
+	 (go top))))
+(print (cdr deep))
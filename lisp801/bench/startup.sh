@@ -0,0 +1,14 @@
+#!/bin/bash
+# Times starting lisp801 by loading core801.lisp against starting it from
+# an image saved after loading core801.lisp.
+# Usage, from lisp801/: bench/startup.sh [binary]
+b=${1:-./lisp801}
+i=${TMPDIR:-/tmp}/startup801.img
+f=${TMPDIR:-/tmp}/startup801.lisp
+echo "(save-image \"$i\")" > $f
+$b core801.lisp $f < /dev/null > /dev/null 2>&1
+echo "core801.lisp:"
+time $b core801.lisp < /dev/null > /dev/null 2>&1
+echo "-i image:"
+time $b -i $i < /dev/null > /dev/null 2>&1
+rm -f $i $f
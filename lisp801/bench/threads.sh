@@ -0,0 +1,24 @@
+#!/bin/bash
+# Runs bench/mark.lisp and bench/alloc.lisp with 1, 2, 4 and 8 collector
+# threads and reports the run time and the collection pauses, timed from
+# the ";garbage collecting..." to the ";done." message on stderr.
+# Usage, from lisp801/: bench/threads.sh [binary]
+b=${1:-./lisp801}
+printf "%-6s %7s %8s %5s %9s %9s\n" bench threads time gcs mean-ms max-ms
+for s in mark alloc; do
+    for t in 1 2 4 8; do
+        a=$EPOCHREALTIME
+        p=$($b -t $t small.lisp bench/$s.lisp 2>&1 > /dev/null < /dev/null |
+            while read -r l; do
+                case $l in
+                    ";garbage"*) g=$EPOCHREALTIME ;;
+                    ";done"*) echo "$g $EPOCHREALTIME" ;;
+                esac
+            done)
+        e=$EPOCHREALTIME
+        echo "$p" | awk -v s=$s -v t=$t -v a=$a -v e=$e '
+            NF { d = ($2 - $1) * 1000; n++; sum += d; if (d > max) max = d }
+            END { printf "%-6s %7d %7.2fs %5d %9.2f %9.2f\n",
+                  s, t, e - a, n, n ? sum / n : 0, max }'
+    done
+done
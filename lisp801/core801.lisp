@@ -354,6 +354,7 @@
     (3 (case (jref object 1)
 	 (20 'simple-string)
 	 (84 'double)
+	 (148 'bignum)
 	 (116 'simple-bit-vector)
 	 (t 'file-stream)))))
 (defmacro ecase (keyform &rest clauses)
@@ -400,8 +401,8 @@
   (or (eq a b)
       (and (= (ldb '(2 . 0) (ival a)) 3)
 	   (= (ldb '(2 . 0) (ival b)) 3)
-	   (= (jref a 1) 84)
-	   (= (jref b 1) 84)
+	   (= (jref a 1) (jref b 1))
+	   (or (= (jref a 1) 84) (= (jref a 1) 148))
 	   (= a b))))
 (defun equal (a b)
   (or (eql a b)
@@ -423,6 +424,9 @@
 	((not a) nil)
 	((characterp a) (and (characterp b)
 			     (char-equal a b)))
+	((member (type-of a) '(fixnum double bignum))
+	 (and (member (type-of b) '(fixnum double bignum))
+	      (= a b)))
 	((consp a) (and (consp b)
 			(equalp (car a) (car b))
 			(equalp (cdr a) (cdr b))))
@@ -647,22 +651,24 @@
 	(handlers (gensym)))
     (dolist (binding (reverse bindings))
       (setq form
-	    `(cons (list ',(car binding) ,(cadr binding) ',handlers) ,form)))
-    `(let ((handlers *handlers*)
-	   (*handlers* ,form))
-      ,@forms)))
+	    `(cons (list ',(car binding) ,(cadr binding) ,handlers) ,form)))
+    `(let ((,handlers *handlers*))
+      (let ((*handlers* ,form))
+	,@forms))))
 (defmacro handler-case (expression &rest clauses)
   (let ((tag (gensym))
 	(bindings nil))
-    `(handler-bind
-      ,(dolist (clause clauses (reverse bindings))
-	 (let ((typespec (car clause))
-	       (var-list (cadr clause))
-	       (forms (cddr clauses)))
-	   (push `(typespec #'(lambda (,(if var-list (car var-list) (gensym)))
-				(return-from tag (progn ,@forms))))
-		 bindings)))
-      ,expression)))
+    `(block ,tag
+      (handler-bind
+	  ,(dolist (clause clauses (reverse bindings))
+	     (let ((typespec (car clause))
+		   (var-list (cadr clause))
+		   (forms (cddr clause)))
+	       (push `(,typespec
+		       #'(lambda (,(if var-list (car var-list) (gensym)))
+			   (return-from ,tag (progn ,@forms))))
+		     bindings)))
+	,expression))))
 (defmacro ignore-errors (&rest forms)
   `(handler-case (progn ,@forms)
     (error (condition) (values nil condition))))
@@ -779,6 +785,7 @@
 (defun symbolp (object) (or (null object) (eq (type-of object) 'symbol)))
 (defun keywordp (object)
   (and (symbolp object)
+       (symbol-package object)
        (string= (package-name (symbol-package object)) "KEYWORD")))
 (defun make-symbol (name)
   (let ((symbol (makei 9 0 name nil nil nil nil (- 1) 0)))
@@ -860,58 +867,33 @@
     (dolist (using-package (iref package 7))
       (when (find-symbol (symbol-name symbol) using-package)
 	(cerror 'package-error :package using-package)))
-    (unless (atom (package-get (iref package 3) (symbol-name symbol)))
-      (unless (atom (package-get (iref package 4) (symbol-name symbol)))
+    (unless (atom (package-get package 3 (symbol-name symbol)))
+      (unless (atom (package-get package 4 (symbol-name symbol)))
 	(cerror 'package-error :package package))
-      (package-rem (iref package 4) symbol)
-      (package-put (iref package 3) symbol))))
-(defun package-rehash (old-vector new-vector)
-  (let ((old-length (length old-vector))
-	(new-length (length new-vector))
-	(i 0))
-    (tagbody
-     start
-       (when (< i old-length)
-	 (dolist (symbol (iref old-vector (+ 2 i)))
-	   (push symbol (iref new-vector (+ 2 (mod (hash (symbol-name symbol))
-						   new-length)))))
-	 (incf i)
-	 (go start)))
-    new-vector))
-(defun package-get (vector string)
-  (dolist (symbol (iref vector (+ 2 (mod (hash string) (length vector))))
-	   '(nil))
-    (when (string= (symbol-name symbol) string)
-      (return symbol))))
-(defun package-put (vector symbol)
-  (push symbol (iref vector (+ 2 (mod (hash (symbol-name symbol))
-				      (length vector))))))
-(defun package-rem (vector string)
-  (let ((index (+ 2 (mod (hash string) (length vector)))))
-    (setf (iref vector index)
-	  (delete string (iref vector index) :key #'symbol-name))))
+      (package-rem package 4 (symbol-name symbol))
+      (package-put package 3 symbol))))
 (defun find-symbol (string &optional (package *package*))
   (setq package (find-package package))
   (unless package
     (error "Package does not exist."))
-  (let ((symbol (package-get (iref package 4) string)))
+  (let ((symbol (package-get package 4 string)))
     (if (atom symbol)
 	(values symbol :internal)
-	(let ((symbol (package-get (iref package 3) string)))
+	(let ((symbol (package-get package 3 string)))
 	  (if (atom symbol)
 	      (values symbol :external)
 	      (dolist (used-package (package-use-list package)
 		       (values nil nil))
-		(let ((symbol (package-get (iref used-package 3) string)))
+		(let ((symbol (package-get used-package 3 string)))
 		  (when (atom symbol)
 		    (values symbol :inherited)))))))))
 (defun find-all-symbols (string)
   (let ((symbols nil))
     (dolist (package *packages*)
-      (let ((symbol (package-get (iref package 4) string)))
+      (let ((symbol (package-get package 4 string)))
 	(when (atom symbol)
 	  (push symbol symbols)))
-      (let ((symbol (package-get (iref package 3) string)))
+      (let ((symbol (package-get package 3 string)))
 	(when (atom symbol)
 	  (push symbol symbols))))
     symbols))
@@ -924,7 +906,7 @@
 	(:inherited
 	 (cerror 'package-error :package package))
 	((nil)
-	 (package-put (iref package 4) symbol)
+	 (package-put package 4 symbol)
 	 (unless (iref symbol 9)
 	   (setf (iref symbol 9) package))))))
   t)
@@ -944,15 +926,15 @@
       (unless (member status '(:internal :external))
 	(setq symbol (make-symbol string))
 	(setf (iref symbol 9) package)
-	(package-put (iref package 4) symbol))
+	(package-put package 4 symbol))
       (pushnew symbol (iref package 5))))
   t)
 (defun shadowing-import (symbols &optional package)
   (setq package (find-package package))
   (dolist (symbol (designator-list symbols))
-    (package-rem (iref package 3) (symbol-name symbol))
-    (package-rem (iref package 4) (symbol-name symbol))
-    (package-put (iref package 4) symbol)
+    (package-rem package 3 (symbol-name symbol))
+    (package-rem package 4 (symbol-name symbol))
+    (package-put package 4 symbol)
     (push symbol (iref package 5)))
   t)
 (defun delete-package (package)
@@ -968,7 +950,7 @@
 	      (when (find-package name)
 		(cerror 'package-error :package name)))
 	  all-names)
-    (let ((package (makei 6 5 all-names (make-array 1021) (make-array 1021) nil
+    (let ((package (makei 6 5 all-names (make-package-table) (make-package-table) nil
 			  (mapcar #'find-package use))))
       (mapc #'(lambda (used-package)
 		(push package (iref (find-package used-package) 7)))
@@ -982,8 +964,8 @@
   (unless (first iterator)
     (setf (first iterator)
 	  (case (pop (third iterator))
-	    (:internal (iref (second iterator) 4))
-	    (:external (iref (second iterator) 3))
+	    (:internal (package-symbols (second iterator) 4))
+	    (:external (package-symbols (second iterator) 3))
 	    (:inherited "FIXME")
 	    ((nil) (return-from package-iterate nil)))))
   (pop (first iterator)))
@@ -1000,19 +982,19 @@
   (dolist (symbol (designator-list symbols))
     (setq symbol (designator-symbol symbol))
     (when symbol
-      (when (atom (package-get (iref package 3) (symbol-name symbol)))
-	(package-rem (iref package 3) (symbol-name symbol))
-	(package-put (iref package 4) symbol))))
+      (when (atom (package-get package 3 (symbol-name symbol)))
+	(package-rem package 3 (symbol-name symbol))
+	(package-put package 4 symbol))))
   t)
 (defun unintern (symbol &optional (package *package*))
   (setq package (find-package package))
   (when (eq package (iref symbol 9))
     (setf (iref symbol 9) nil))
   (let* ((name (symbol-name symbol))
-	 (present (or (atom (package-get (iref package 3) name))
-		      (atom (package-get (iref package 4) name)))))
-    (package-rem (iref package 3) name)
-    (package-rem (iref package 4) name)
+	 (present (or (atom (package-get package 3 name))
+		      (atom (package-get package 4 name)))))
+    (package-rem package 3 name)
+    (package-rem package 4 name)
     (setf (iref package 5) (delete symbol (iref package 5)))
     present))
 (defmacro in-package (name)
@@ -1080,16 +1062,16 @@
     `(block nil
       (let ((,package-sym (find-package package))
 	    (,var nil))
-	(dolist (,var (iref ,package-sym 3))
+	(dolist (,var (package-symbols ,package-sym 3))
 	  ,@forms)
-	(dolist (,var (iref ,pakcage-sym 4))
+	(dolist (,var (package-symbols ,package-sym 4))
 	  ,@forms)
 	,result-form))))
 (defmacro do-external-symbols ((var &optional (package *package*) result-form)
 			       &rest forms)
   (let ((package-sym (gensym)))
     `(let ((,package-sym (find-package ,package)))
-      (dolist (,var (iref ,package-sym 3) ,result-form)
+      (dolist (,var (package-symbols ,package-sym 3) ,result-form)
 	,@forms))))
 (defmacro do-all-symbols ((var &optional result-form) &rest forms)
   (let ((package (gensym))
@@ -1101,7 +1083,7 @@
 	   (,first t))
       (dolist (,package *packages* ,result-form)
 	,start-out
-	(setq ,symbols (iref ,package (if ,first 3 4)))
+	(setq ,symbols (package-symbols ,package (if ,first 3 4)))
 	(setq ,first (not ,first))
 	,start
 	(when ,symbols
@@ -1118,10 +1100,10 @@
       (setf (iref symbol 9) package)
       (cond
 	((string= (package-name package) "KEYWORD")
-	 (package-put (iref package 3) symbol)
+	 (package-put package 3 symbol)
 	 (setf (symbol-value symbol) symbol))
 	(t
-	 (package-put (iref package 4) symbol))))
+	 (package-put package 4 symbol))))
     (values symbol status)))
 (defun package-name (package) (car (iref (find-package package) 2)))
 (defun package-nicknames (package) (cdr (iref (find-package package) 2)))
@@ -2152,21 +2134,27 @@
 	     (setf (iref vector 3) new-fill-pointer)))
     (t (error "not a vector with fill pointer"))))
 (defparameter *big-endian* (= (ldb '(8 . 0) (jref "ABCD" 2)) 68))
+(defparameter *word-bytes*
+  (if (zerop (floor (jref "ABCDEFGH" 2) 4294967296)) 4 8))
+(defparameter *word-bits* (* 8 *word-bytes*))
 (if *big-endian*
     (defun row-major-aref (array index)
       (case (array-type array)
-	(0 (code-char (ldb (cons 8 (* 8 (- 3 (ldb '(2 . 0) index))))
-			   (jref array (+ 2 (/ index 4))))))
-	(1 (ldb (cons 1 (ldb '(5 . 0) index)) (jref array (+ 2 (/ index 32)))))
+	(0 (code-char (ldb (cons 8 (* 8 (- *word-bytes* 1
+					   (mod index *word-bytes*))))
+			   (jref array (+ 2 (floor index *word-bytes*))))))
+	(1 (ldb (cons 1 (mod index *word-bits*))
+		(jref array (+ 2 (floor index *word-bits*)))))
 	(2 (iref array (+ 2 index)))
 	(3 (row-major-aref (iref array 4) index))
 	(4 (error "accessing nil array"))
 	(t (error "not an array"))))
     (defun row-major-aref (array index)
       (case (array-type array)
-	(0 (code-char (ldb (cons 8 (* 8 (ldb '(2 . 0) index)))
-			   (jref array (+ 2 (/ index 4))))))
-	(1 (ldb (cons 1 (ldb '(5 . 0) index)) (jref array (+ 2 (/ index 32)))))
+	(0 (code-char (ldb (cons 8 (* 8 (mod index *word-bytes*)))
+			   (jref array (+ 2 (floor index *word-bytes*))))))
+	(1 (ldb (cons 1 (mod index *word-bits*))
+		(jref array (+ 2 (floor index *word-bits*)))))
 	(2 (iref array (+ 2 index)))
 	(3 (row-major-aref (iref array 4) index))
 	(4 (error "accessing nil array"))
@@ -2175,13 +2163,13 @@
     (defun (setf row-major-aref) (new-element array index)
       (case (array-type array)
 	(0 (multiple-value-bind (index-major index-minor)
-	       (floor index 4)
+	       (floor index *word-bytes*)
 	     (setf (jref array (+ 2 index-major))
 		   (dpb (char-code new-element)
-			(cons 8 (* 8 (- 3 index-minor)))
+			(cons 8 (* 8 (- *word-bytes* 1 index-minor)))
 			(jref array (+ 2 index-major))))))
 	(1 (multiple-value-bind (index-major index-minor)
-	       (floor index 32)
+	       (floor index *word-bits*)
 	     (setf (jref array (+ 2 index-major))
 		   (dpb new-element
 			(cons 1 index-minor)
@@ -2194,13 +2182,13 @@
     (defun (setf row-major-aref) (new-element array index)
       (case (array-type array)
 	(0 (multiple-value-bind (index-major index-minor)
-	       (floor index 4)
+	       (floor index *word-bytes*)
 	     (setf (jref array (+ 2 index-major))
 		   (dpb (char-code new-element)
 			(cons 8 (* 8 index-minor))
 			(jref array (+ 2 index-major))))))
 	(1 (multiple-value-bind (index-major index-minor)
-	       (floor index 32)
+	       (floor index *word-bits*)
 	     (setf (jref array (+ 2 index-major))
 		   (dpb new-element
 			(cons 1 index-minor)
@@ -2429,15 +2417,16 @@
   (let* ((string (makej (+ 1 (* size 8)) 20))
 	 (i 0)
 	 (init-code (char-code initial-element))
-	 (init (* 16843009 init-code)))
+	 (init (* (if (= *word-bytes* 8) 72340172838076673 16843009)
+		  init-code)))
     (tagbody
      start
-       (when (< i (/ size 4))
+       (when (< i (floor size *word-bytes*))
 	 (setf (jref string (+ 2 i)) init)
 	 (setf i (+ 1 i))
 	 (go start)))
-    (setf (jref string (+ 2 (/ size 4)))
-	  (dpb init (cons (* 8 (ldb '(2 . 0) size)) 0) 0))
+    (setf (jref string (+ 2 (floor size *word-bytes*)))
+	  (dpb init (cons (* 8 (mod size *word-bytes*)) 0) 0))
     string))
 (defun reverse (sequence)
   (if (listp sequence)
@@ -2602,6 +2591,37 @@
   (if (listp sequence)
       (setf (nth index sequence) new-object)
       (setf (aref sequence index) new-object)))
+(defun sort-sequence (sequence predicate key stable)
+  (let ((mode (cond (key 0)
+		    ((or (eq predicate '<) (eq predicate #'<)) 1)
+		    ((or (eq predicate 'string<) (eq predicate #'string<)) 2)
+		    (t 0))))
+    (cond
+      ((listp sequence) (sort-list sequence predicate key mode))
+      ((= (array-type sequence) 2)
+       (sort-vector sequence predicate key mode stable))
+      (t (let* ((size (length sequence))
+		(vector (makei size 3))
+		(index 0))
+	   (tagbody
+	    start
+	      (when (< index size)
+		(setf (iref vector (+ 2 index)) (aref sequence index))
+		(setf index (+ 1 index))
+		(go start)))
+	   (sort-vector vector predicate key mode stable)
+	   (setf index 0)
+	   (tagbody
+	    start
+	      (when (< index size)
+		(setf (aref sequence index) (iref vector (+ 2 index)))
+		(setf index (+ 1 index))
+		(go start)))
+	   sequence)))))
+(defun sort (sequence predicate &key key)
+  (sort-sequence sequence predicate key nil))
+(defun stable-sort (sequence predicate &key key)
+  (sort-sequence sequence predicate key t))
 (defun make-sequence (result-type size &key initial-element)
   (let ((type-head (car (designator-list result-type))))
     (case type-head
@@ -2686,106 +2706,30 @@
 (setf (iref *standard-class* 1) *standard-class*)
 (defparameter *structure-class* (makei 1 *standard-class*))
 (defparameter *hash-table* (makei 1 *structure-class*))
-(defun hash-eql (object)
-  (if (and (= (ldb '(2 . 0) (ival object)) 3) (= (jref object 1) 84))
-      (floor (abs object))
-      (ival object)))
-(defun sxhash (object &optional (level 4))
-  (if (zerop level)
-      0
-      (let ((lvl (- level 1)))
-	(case (ldb '(2 . 0) (ival object))
-	  (0 (ival object))
-	  (1 (+ (sxhash (car object) lvl) (sxhash (cdr object) lvl)))
-	  (2 (case (iref object 1)
-	       (t (ival object))))
-	  (3 (case (jref object 1)
-	       (20 (hash object))
-	       (84 (floor (abs object)))
-	       (t (ival object))))))))
 (defun make-hash-table (&key (test 'eql) (size 61) (rehash-size 1.999)
 			(rehash-threshold 1))
   (when (functionp test)
     (setq test (iref test 6)))
-  (makei 6 *hash-table* 0 rehash-size rehash-threshold test
+  (makei 9 *hash-table* 0 rehash-size rehash-threshold test
 	 (case test
-	   (eq #'ival)
-	   (eql #'hash-eql)
-	   (equal #'sxhash)
-	   (equalp #'hash-equalp)
+	   (eq 0)
+	   (eql 1)
+	   (equal 2)
+	   (string= 3)
+	   (equalp 4)
 	   (t (error "Unknown test function ~A." test)))
-	 (makei size 3)))
-(defun gethash (key hash-table &optional default)
-  (let* ((table (hash-table-table hash-table))
-	 (test (hash-table-test hash-table))
-	 (index (mod (funcall (hash-table-hash hash-table) key)
-		     (length table))))
-    (dolist (cons (iref table (+ 2 index)) (values default nil))
-      (when (funcall test (car cons) key)
-	(return (values (cdr cons) t))))))
-(defun (setf gethash) (new-value key hash-table &optional default)
-  (let* ((table (hash-table-table hash-table))
-	 (test (hash-table-test hash-table))
-	 (index (mod (funcall (hash-table-hash hash-table) key)
-		     (length table))))
-    (dolist (cons (iref table (+ 2 index))
-	     (progn
-	       (push (cons key new-value) (iref table (+ 2 index)))
-	       (unless (< (incf (hash-table-count hash-table))
-			  (* (hash-table-rehash-threshold hash-table)
-			     (length table)))
-		 (setf (hash-table-table hash-table)
-		       (makei (floor (* (hash-table-rehash-size hash-table)
-					(length table)))
-			      3))
-		 (setf (hash-table-count hash-table) 0)
-		 (dotimes (index (length table))
-		   (dolist (cons (iref table (+ 2 index)))
-		     (setf (gethash (car cons) hash-table) (cdr cons)))))))
-      (when (funcall test (car cons) key)
-	(setf (cdr cons) new-value)
-	(return (values (cdr cons) t)))))
-  new-value)
-(defun remhash (key hash-table)
-  (let* ((table (hash-table-table hash-table))
-	 (test (hash-table-test hash-table))
-	 (index (mod (funcall (hash-table-hash hash-table) key)
-		     (length table)))
-	 (cons (iref table (+ 2 index)))
-	 (prev-cons nil))
-    (tagbody
-     start
-       (unless cons (return-from remhash))
-       (unless (funcall test (caar cons) key)
-	 (setq prev-cons cons)
-	 (setq cons (cdr cons))
-	 (go start)))
-    (if prev-cons
-	(setf (cdr prev-cons) (cdr cons))
-	(setf (iref table (+ 2 index)) (cdr cons)))
-    (decf (hash-table-count hash-table))
-    t))
-(defun maphash (function hash-table)
-  (let ((table (hash-table-table hash-table)))
-    (dotimes (index (length table))
-      (dolist (cons (iref table (+ 2 index)))
-	(funcall function (car cons) (cdr cons))))))
+	 (make-hash-table-table size)
+	 nil 0))
+(defun make-hash-table-table (size)
+  (do ((n 8 (* 2 n)))
+      ((>= (* 3 n) (* 4 size)) (makei (* 3 n) 3))))
 (defun hash-table-iterator (hash-table)
-  (let ((table (hash-table-table hash-table))
-	(index 0)
-	(cons nil))
+  (let ((entries (hash-table-entries hash-table))
+	(index 0))
     #'(lambda ()
-	(block nil
-	  (tagbody
-	   start
-	     (unless cons
-	       (unless (< index (length table))
-		 (return))
-	       (setq cons (iref table (+ 2 index)))
-	       (incf index)
-	       (go start)))
-	  (let ((pair (pop cons)))
-	    (values t (car pair) (cdr pair)))))))
+	(when (< index (length entries))
+	  (incf index 2)
+	  (values t (svref entries (- index 2)) (svref entries (- index 1)))))))
 (defmacro with-hash-table-iterator ((name hash-table) &rest forms)
   (let ((iterator (gensym)))
     `(let ((,iterator (hash-table-iterator ,hash-table)))
@@ -2793,21 +2737,16 @@
 		   `(funcall ,,iterator)))
 	,@forms))))
 (defun clrhash (hash-table)
-  (let ((table (hash-table-table hash-table)))
-    (dotimes (index (length table))
-      (setf (iref table (+ 2 index)) nil)))
-  (setf (hash-table-count hash-table) 0)
+  (setf (iref hash-table 2) 0)
+  (setf (iref hash-table 7)
+	(makei (length (iref hash-table 7)) 3))
+  (setf (iref hash-table 8) nil)
+  (setf (iref hash-table 9) 0)
   hash-table)
 (defun hash-table-count (hash-table) (iref hash-table 2))
-(defun (setf hash-table-count) (new-value hash-table)
-  (setf (iref hash-table 2) new-value))
 (defun hash-table-rehash-size (hash-table) (iref hash-table 3))
 (defun hash-table-rehash-threshold (hash-table) (iref hash-table 4))
 (defun hash-table-test (hash-table) (iref hash-table 5))
-(defun hash-table-hash (hash-table) (iref hash-table 6))
-(defun hash-table-table (hash-table) (iref hash-table 7))
-(defun (setf hash-table-table) (new-value hash-table)
-  (setf (iref hash-table 7) new-value))
 (defparameter *class-hash* (make-hash-table))
 (defun find-class (symbol &optional (errorp t) environment)
   (multiple-value-bind (class foundp)
@@ -2831,29 +2770,22 @@
       (makei 7 3 'structure-object (list (find-class 't)) nil
 	     (list *structure-object* (find-class 't))))
 (defun make-boa-constructor (length struct-class slots lambda-list)
-  (eval `#'(lambda ,lambda-list
-	     (let ((s (makei ,length ',struct-class
-			     ,@(mapcar #'(lambda (arg)
-					   (cadr arg))
-				       slots))))
-	       ,@(mapcar #'(lambda (argument)
-			     (unless (member argument lambda-list-keywords)
-			       (let ((arg (if (consp argument)
-					      (car argument)
-					      argument)))
-				 `(setf (iref s ,(+ 2 (position arg slots
-								:key #'car)))
-				   ,arg))))
-			 lambda-list)
-	       s))))
+  (let ((args (mapcar #'(lambda (argument)
+			  (if (consp argument)
+			      (car argument)
+			      argument))
+		      lambda-list)))
+    (eval `#'(lambda ,lambda-list
+	       (makei ,length ',struct-class
+		      ,@(mapcar #'(lambda (slot)
+				    (if (member (car slot) args)
+					(car slot)
+					(cadr slot)))
+				slots))))))
 (defun ensure-struct (name options documentation slots)
   (flet ((option (option-name default)
 	   (let ((pair (assoc option-name options)))
-	     (if pair (cdr pair) default)))
-	 (make-getter (i)
-	   #'(lambda (x) (iref x i)))
-	 (make-setter (i)
-	   #'(lambda (v x) (setf (iref x i) v))))
+	     (if pair (cdr pair) default))))
     (let* ((struct-class (makei 1 *structure-class* (makei 7 3)))
 	   (conc-name (option :conc-name (conc-string name "-")))
 	   (constructor (option :constructor nil))
@@ -2895,8 +2827,10 @@
       (let ((i 2))
 	(dolist (slot effective-slots)
 	  (let ((accessor (intern (conc-string conc-name (car slot)))))
-	    (setf (fdefinition accessor) (make-getter i))
-	    (setf (fdefinition `(setf ,accessor)) (make-setter i))
+	    (setf (fdefinition accessor)
+		  (struct-accessor struct-class i accessor nil))
+	    (setf (fdefinition `(setf ,accessor))
+		  (struct-accessor struct-class i `(setf ,accessor) t))
 	    (setf i (+ 1 i)))))
       (setf (find-class name) struct-class)))
   name)
@@ -3230,12 +3164,23 @@
   (setf (ansi-stream-unread input-stream) character))
 (defun write-char (character &optional (output-stream *standard-output*))
   (setq output-stream (designator-output-stream output-stream))
-  (write-file-stream (make-string 1 :initial-character character) 0 1)
+  (ansi-stream-write-bytes output-stream
+			   (make-string 1 :initial-element character) 0 1)
   (setf (ansi-stream-line-start output-stream) (= (char-code character) 10))
   character)
 (defun read-line (&optional (input-stream *standard-input*) (eof-error-p t)
 		  eof-value recursive-p)
   (setq input-stream (designator-input-stream input-stream))
+  (when (and (fd-stream-p input-stream)
+	     (not (ansi-stream-unread input-stream)))
+    (multiple-value-bind (line missing-newline-p)
+	(read-line-file-stream (fd-stream-file-stream input-stream))
+      (return-from read-line
+	(if line
+	    (values line missing-newline-p)
+	    (if eof-error-p
+		(error 'end-of-file :stream input-stream)
+		(values eof-value t))))))
   (let ((result nil)
 	(end nil))
     (tagbody
@@ -3272,8 +3217,11 @@
   (setf (ansi-stream-line-start output-stream) t)
   string)
 (defun read-sequence (sequence stream &key (start 0) end)
-  (if (eq (type-of sequence) 'string)
-      (+ start (ansi-stream-read-bytes stream sequence start))
+  (if (stringp sequence)
+      (if (and (fd-stream-p stream) (not (ansi-stream-unread stream)))
+	  (+ start (read-file-stream (fd-stream-file-stream stream) sequence
+				     start (or end (length sequence))))
+	  (+ start (ansi-stream-read-bytes stream sequence start)))
       (let ((index start))
 	(tagbody
 	 start
@@ -3285,8 +3233,8 @@
 		 (go start)))))
 	index)))
 (defun write-sequence (sequence stream &key (start 0) end)
-  (if (eq (type-of sequence) 'string)
-      (write-string sequence stream start end)
+  (if (stringp sequence)
+      (write-string sequence stream :start start :end end)
       (let ((index start))
 	(unless end (setf end (length sequence)))
 	(tagbody
@@ -3487,47 +3435,51 @@
        (when (< j i)
 	 (push (subseq control-string j i) result)))
     (reverse result)))
+(defun format-directive (elem)
+  (if (stringp elem)
+      `(write-string ,elem output-stream)
+      (let ((params (cdddr elem)))
+	(flet ((base (base)
+		 `(let ((*print-radix* nil)
+			(*print-base* ,base))
+		    (princ (pop arguments) output-stream)))
+	       (times (n form)
+		 (if (eql n 1) form `(dotimes (n ,n) ,form))))
+	  (case (car elem)
+	    (37 (times (or (car params) 1) '(terpri output-stream)))
+	    (38 `(progn (fresh-line output-stream)
+			,(times (- (or (car params) 1) 1)
+				'(terpri output-stream))))
+	    (65 '(princ (pop arguments) output-stream))
+	    (66 (base 2))
+	    (67 '(write-char (pop arguments) output-stream))
+	    (68 (base 10))
+	    (79 (base 8))
+	    (82 (base (car params)))
+	    (83 '(prin1 (pop arguments) output-stream))
+	    (87 '(write (pop arguments) :stream output-stream))
+	    (88 (base 16))
+	    (124 (times (or (car params) 1) '(write-byte 12 output-stream)))
+	    (126 (times (or (car params) 1) '(write-byte 126 output-stream)))
+	    (t '(error "unimplemented format character")))))))
+(defun format-lambda (control-string)
+  `#'(lambda (output-stream &rest arguments)
+       ,@(mapcar #'format-directive
+		 (remove "" (parse-control-string control-string) :test #'equal))
+       nil))
+(defparameter *format-cache* (make-hash-table :test 'equal))
 (defun format-function (control-string)
-  #'(lambda (output-stream &rest arguments)
-      (let ((program (parse-control-string control-string)))
-	(dolist (elem program)
-	  (if (stringp elem)
-	      (write-string elem output-stream)
-	      (let ((colonp (cadr elem))
-		    (atp (caddr elem))
-		    (params (cdddr elem)))
-		(case (car elem)
-		  (37 (dotimes (n (or (car params) 1))
-			(terpri output-stream)))
-		  (38 (fresh-line output-stream)
-		      (dotimes (n (- (or (car params) 1) 1))
-			(terpri output-stream)))
-		  (65 (princ (pop arguments) output-stream))
-		  (66 (let ((*print-radix* nil)
-			    (*print-base* 2))
-			(princ (pop arguments) output-stream)))
-		  (67 (write-char (pop arguments) output-stream))
-		  (68 (let ((*print-radix* nil)
-			    (*print-base* 10))
-			(princ (pop arguments) output-stream)))
-		  (79 (let ((*print-radix* nil)
-			    (*print-base* 8))
-			(princ (pop arguments) output-stream)))
-		  (82 (let ((*print-radix* nil)
-			    (*print-base* (car params)))
-			(princ (pop arguments) output-stream)))
-		  (83 (prin1 (pop arguments) output-stream))
-		  (87 (write (pop arguments) :stream output-stream))
-		  (88 (let ((*print-radix* nil)
-			    (*print-base* 16))
-			(princ (pop arguments) output-stream)))
-		  (124 (dotimes (n (or (car params) 1))
-			 (write-byte 12 output-stream)))
-		  (126 (dotimes (n (or (car params) 1))
-			 (write-byte 126 output-stream)))
-		  (t (error "unimplemented format character")))))))))
+  (or (and (functionp control-string) control-string)
+      (gethash control-string *format-cache*)
+      (progn
+	(when (>= (hash-table-count *format-cache*) 256)
+	  (clrhash *format-cache*))
+	(setf (gethash (subseq control-string 0) *format-cache*)
+	      (eval (format-lambda control-string))))))
 (defmacro formatter (control-string)
-  `(format-function ,control-string))
+  (if (stringp control-string)
+      (format-lambda control-string)
+      `(format-function ,control-string)))
 (defmacro print-unreadable-object ((object stream &key type identity)
 				   &rest forms)
   (let ((object-var (gensym))
@@ -3552,10 +3504,11 @@
 	(write-string ">" ,stream-var)
 	nil))))
 (defun format (destination control-string &rest args)
-  (if destination
-      (progn (apply (formatter control-string) destination args) nil)
-      (with-output-to-string (destination)
-	(apply (formatter control-string) destination args))))
+  (let ((function (format-function control-string)))
+    (if destination
+	(progn (apply function destination args) nil)
+	(with-output-to-string (destination)
+	  (apply function destination args)))))
 (defmacro with-standard-io-syntax (&rest forms)
   `(let ((*package* (find-package "CL-USER"))
 	 (*print-array* t)
@@ -4259,6 +4212,7 @@
     (3 (case (jref object 1)
 	 (20 (find-class 'string))
 	 (84 (find-class 'real))
+	 (148 (find-class 'integer))
 	 (116 (find-class 'bit-vector))
 	 (t (find-class 't))))))
 (defparameter *funcallable-standard-class* (makei 1 *standard-class*))
@@ -4311,15 +4265,16 @@
 					    super))
 				    direct-superclasses))
   (setf (iref class 2)
-	(makei 9 3 name direct-superclasses
+	(makei 10 3 name direct-superclasses
 	       (mapcar #'(lambda (slot)
 			   (apply #'make-standard-direct-slot slot))
 		       direct-slots)
 	       nil nil nil nil
-	       direct-default-initargs))
+	       direct-default-initargs nil nil))
   (setf (find-class name) class)
   (dolist (super direct-superclasses)
     (push class (iref (iref super 2) 7)))
+  (gf-cache-flush)
   (dolist (slot (iref (iref class 2) 4))
     (dolist (reader (iref (iref slot 2) 8))
       (add-reader-method class reader slot))
@@ -4333,7 +4288,9 @@
     (setf (iref (iref class 2) 5)
 	  (standard-compute-class-precedence-list class))
     (setf (iref (iref class 2) 6)
-	  (standard-compute-slots class)))
+	  (standard-compute-slots class))
+    (setf (iref (iref class 2) 11)
+	  (standard-compute-slot-locations class)))
   (values))
 (defun standard-compute-class-precedence-list (class)
   (let ((superclasses (cons class (reduce #'union
@@ -4375,6 +4332,18 @@
 		(standard-compute-effective-slot-definition class (car cons)
 							    (cdr cons)))
 	    (reverse defs))))
+(defun standard-compute-slot-locations (class)
+  (let* ((slots (iref (iref class 2) 6))
+	 (locations (make-hash-table :test 'eq :size (length slots)))
+	 (index 2))
+    (dolist (slot slots locations)
+      (cond
+	((eq :instance (iref (iref slot 2) 6))
+	 (setf (gethash (iref (iref slot 2) 2) locations) index)
+	 (incf index))
+	(t
+	 (setf (gethash (iref (iref slot 2) 2) locations)
+	       (iref (iref slot 2) 8)))))))
 (defun standard-compute-effective-slot-definition (class name
 						   direct-slot-definitions)
   (let* ((init-slot (find-if #'(lambda (slot)
@@ -4406,9 +4375,7 @@
 			     :lambda-list '(object)
 			     :qualifiers nil
 			     :specializers (list class)
-			     :function
-			     #'(lambda (args next)
-				 (slot-value (car args) slot-name))))))
+			     :function (slot-reader slot-name fn-name)))))
 (defun add-writer-method (class fn-name slot)
   (let ((slot-name (iref (iref slot 2) 2))
 	(gf (ensure-generic-function fn-name
@@ -4420,10 +4387,7 @@
 			     :lambda-list '(new-value object)
 			     :qualifiers nil
 			     :specializers (list (find-class 't) class)
-			     :function
-			     #'(lambda (args next)
-				 (setf (slot-value (cadr args) slot-name)
-				       (car args)))))))
+			     :function (slot-writer slot-name fn-name)))))
 (defun slot-value (object slot-name)
   (let ((class (iref object 1)))
     (if (or (eq (iref class 1) *standard-class*)
@@ -4433,38 +4397,37 @@
 				(find slot-name (class-slots class)
 				      :key #'slot-definition-name)))))
 (defun standard-slot-value (class object slot-name)
-  (let ((index 2))
-    (dolist (slot (iref (iref class 2) 6))
-      (cond
-	((eq :instance (iref (iref slot 2) 6))
-	 (when (eq slot-name (iref (iref slot 2) 2))
-	   (unless (iboundp (iref object 2) index)
-	     (write-line "unbound slot")
-	     (write-line (symbol-name slot-name)))
-	   (return (iref (iref object 2) index)))
-	 (incf index))
-	(t
-	 (when (eq slot-name (iref (iref slot 2) 2))
-	   (return (iref (iref (iref (iref slot 2) 8) 2) 10))))))))
+  (let ((location (gethash slot-name (iref (iref class 2) 11))))
+    (cond
+      ((fixnump location)
+       (unless (iboundp (iref object 2) location)
+	 (write-line "unbound slot")
+	 (write-line (symbol-name slot-name)))
+       (iref (iref object 2) location))
+      (location
+       (iref (iref location 2) 10)))))
+(defun slot-location (object slot-name)
+  (let ((class (iref object 1)))
+    (when (or (eq (iref class 1) *standard-class*)
+	      (eq (iref class 1) *funcallable-standard-class*))
+      (let ((location (gethash slot-name (iref (iref class 2) 11))))
+	(when (fixnump location)
+	  location)))))
 (defun (setf slot-value) (new-value object slot-name)
   (let ((class (iref object 1)))
-    (if (eq (iref class 1) *standard-class*)
+    (if (or (eq (iref class 1) *standard-class*)
+	    (eq (iref class 1) *funcallable-standard-class*))
 	(setf (standard-slot-value class object slot-name) new-value)
 	(setf (slot-value-using-class class object
 				      (find slot-name (class-slots class)
 					    :key #'slot-definition-name))))))
 (defun (setf standard-slot-value) (new-value class object slot-name)
-  (let ((index 2))
-    (dolist (slot (iref (iref class 2) 6))
-      (cond
-	((eq :instance (iref (iref slot 2) 6))
-	 (when (eq slot-name (iref (iref slot 2) 2))
-	   (return (setf (iref (iref object 2) index) new-value)))
-	 (incf index))
-	(t
-	 (when (eq slot-name (iref (iref slot 2) 2))
-	   (return (setf (iref (iref (iref (iref slot 2) 8) 2) 10)
-			 new-value))))))))
+  (let ((location (gethash slot-name (iref (iref class 2) 11))))
+    (cond
+      ((fixnump location)
+       (setf (iref (iref object 2) location) new-value))
+      (location
+       (setf (iref (iref location 2) 10) new-value)))))
 (defun ensure-generic-function (function-name &rest rest
 				&key (generic-function-class
 				      *standard-generic-function*))
@@ -4482,8 +4445,7 @@
       (let ((gf (makei 2 *standard-generic-function*
 		       (makei 9 3 function-name lambda-list nil method-class
 			      argument-precedence-order declarations
-			      method-combination
-			      (make-hash-table :test #'equal))
+			      method-combination nil)
 		       #'(lambda (&rest rest) (error "No methods defined.")))))
 	(setf (iref gf 0) 16)
 	(setf (fdefinition function-name) gf))))
@@ -4499,42 +4461,42 @@
 (defun add-standard-method (generic-function method)
   (push method (iref (iref generic-function 2) 4))
   (setf (iref (iref method 2) 3) generic-function)
+  (setf (iref (iref generic-function 2) 9) nil)
   (setf (iref (iref generic-function 2) 10)
 	(length (iref (iref method 2) 5)))
   (let ((df (compute-standard-discriminating-function generic-function)))
     (set-funcallable-instance-function generic-function df)))
 (defparameter *emf-args* (gensym))
 (defun compute-standard-discriminating-function (generic-function)
-  #'(lambda (&rest arguments)
-      (let* ((classes (mapcar #'class-of
+  (gf-dispatcher
+   generic-function
+   #'(lambda (&rest arguments)
+       (let ((classes (mapcar #'class-of
 			      (subseq arguments
-				      0 (iref (iref generic-function 2) 10))))
-	     (emf (gethash classes (iref (iref generic-function 2) 9))))
-	(if emf
-	    (apply emf arguments)
-	    (multiple-value-bind (methods memoizablep)
-		(compute-standard-applicable-methods-using-classes
-		 generic-function classes)
-	      (unless memoizablep
-		(setq methods (compute-standard-applicable-methods
-			       generic-function arguments)))
-	      (unless methods
-		(apply #'no-applicable-method generic-function arguments))
-	      (multiple-value-bind (effective-method effective-method-options)
-		  (compute-standard-effective-method
-		   generic-function (iref (iref generic-function 2) 8) methods)
-		(let ((emf (coerce `(lambda (&rest ,*emf-args*)
-				     ,effective-method)
-				   'function)))
-		  (when memoizablep
-		    (setf (gethash classes (iref (iref generic-function 2) 9))
-			  emf))
-		  (apply emf arguments))))))))
+				      0 (iref (iref generic-function 2) 10)))))
+	 (multiple-value-bind (methods memoizablep)
+	     (compute-standard-applicable-methods-using-classes
+	      generic-function classes)
+	   (unless memoizablep
+	     (setq methods (compute-standard-applicable-methods
+			    generic-function arguments)))
+	   (unless methods
+	     (apply #'no-applicable-method generic-function arguments))
+	   (multiple-value-bind (effective-method effective-method-options)
+	       (compute-standard-effective-method
+		generic-function (iref (iref generic-function 2) 8) methods)
+	     (let ((emf (coerce `(lambda (&rest ,*emf-args*)
+				  ,effective-method)
+				'function)))
+	       (when memoizablep
+		 (gf-cache-store generic-function emf arguments))
+	       (apply emf arguments))))))))
 (defun compute-standard-applicable-methods-using-classes
     (generic-function classes)
   (let ((applicable nil)
 	(depths nil))
     (dolist (method (iref (iref generic-function 2) 4))
+      (setq depths nil)
       (block method
 	(do ((specializers (iref (iref method 2) 5) (cdr specializers))
 	     (clss classes (cdr clss)))
@@ -4550,7 +4512,7 @@
 	      (depths (reverse depths)))
 	  (do () ((or (not point)
 		      (do ((dl depths (cdr dl))
-			   (dr (cdr point) (cdr dr)))
+			   (dr (cdar point) (cdr dr)))
 			  ((not dl))
 			(when (< (car dl) (car dr))
 			  (return t))
@@ -4698,7 +4660,9 @@
    (direct-methods :accessor class-direct-methods)
    (direct-default-initargs :accessor class-direct-default-initargs
 			    :initform nil)
-   (default-initargs :accessor class-default-initargs)))
+   (default-initargs :accessor class-default-initargs)
+   (slot-locations :accessor class-slot-locations
+		   :initform nil)))
 (defclass built-in-class (class) ())
 (defclass forward-referenced-class (class) ())
 (defclass standard-class (class) ())
@@ -4727,7 +4691,7 @@
   (let* ((direct-superclasses (mapcar #'find-class (cadr built-in-def)))
 	 (class (or (find-class (car built-in-def) nil)
 		    (makei 1 *built-in-class*))))
-    (setf (iref class 2) (makei 8 3 (car built-in-def) direct-superclasses))
+    (setf (iref class 2) (makei 10 3 (car built-in-def) direct-superclasses))
     (setf (find-class (car built-in-def)) class)
     (dolist (super direct-superclasses)
       (push class (iref (iref super 2) 7)))
@@ -4822,8 +4786,7 @@
       (let* ((gf (ensure-generic-function reader :lambda-list '(object)))
 	     (slot-name (slot-definition-name slot))
 	     (initargs (list :slot-definition slot :lambda-list '(object)
-			     :function #'(lambda (args next)
-					   (slot-value (car args) slot-name))
+			     :function (slot-reader slot-name reader)
 			     :qualifiers nil :specializers (list class)))
 	     (reader-method-class (reader-method-class class slot initargs)))
 	(add-method gf (apply #'make-instance reader-method-class initargs))))
@@ -4834,10 +4797,7 @@
 	     (initargs (list :slot-definition slot :qualifiers nil
 			     :lambda-list '(new-value object)
 			     :specializers (list (find-class 't) class)
-			     :function
-			     #'(lambda (args next)
-				 (setf (slot-value (cadr args) slot-name)
-				       (car args)))))
+			     :function (slot-writer slot-name writer)))
 	     (writer-method-class (writer-method-class class slot initargs)))
 	(add-method gf (apply #'make-instance writer-method-class initargs)))))
   (dolist (super (class-direct-superclasses class))
@@ -4877,6 +4837,8 @@
 	(compute-class-precedence-list class))
   (setf (class-slots class)
 	(compute-slots class))
+  (setf (class-slot-locations class)
+	(standard-compute-slot-locations class))
   (setf (class-default-initargs class)
 	(compute-default-initargs class)))
 (defmethod class-finalized-p ((class class))
@@ -5107,6 +5069,7 @@
 	 (84 (if (zerop (nth-value 1 (floor object)))
 		 (write-string (integer-string object *print-base*) stream)
 		 (write-string "#<double>" stream)))
+	 (148 (write-string (integer-string object *print-base*) stream))
 	 (116 (write-string "#<file-stream>" stream))
 	 (180 (write-string "" stream))
 	 (t (write-string "#<bit object " stream)
@@ -5171,6 +5134,7 @@
     (7 (error 'program-error))
     (8 (error 'control-error))
     (9 (error 'control-error))
+    (10 (error 'type-error :datum (car args) :expected-type (cadr args)))
     (t (error "ierror ~A ~A~%" index args))))
 (defvar *compilation*)
 (defparameter *compiler-output* *standard-output*)
@@ -5183,17 +5147,27 @@
 		      (make-array 32 :adjustable t :fill-pointer 0
 				  :initial-element 0)
 		      *compiler-output*)))
-    (format *compiler-output* "#include \"lisp500.h\"~%")
+    (format *compiler-output* "#include <stdint.h>
+typedef intptr_t lval;
+#define o2a(o) ((lval*)((o) - 2))
+lval ma(lval*, intptr_t, ...);
+lval ms(lval*, intptr_t, ...);
+lval call(lval*, lval, uintptr_t);
+void wb(lval*, lval);
+int dbgr(lval*, int, lval, lval*);
+void fasr(lval*, lval*, intptr_t, lval*, lval*, intptr_t, lval*, intptr_t,
+ lval*, intptr_t, lval*, intptr_t, lval**, lval**);~%")
     (when (featurep :windows)
       (format *compiler-output* "#include <windows.h>~%"))
     (format *compiler-output* "lval *value, *opaque;~%")
+    (format *compiler-output* "extern lval package[], symbol[], klass[];~%")
     compilation))
 (if (featurep :windows)
     (defun run-cc (basename)
       (run-program "c:/Program Files/Microsoft Visual Studio/VC98/bin/cl.exe"
 		   (conc-string "cl /LD /Fe" basename ".dll " basename
-				".c lisp500.lib")))
-    (let ((end (if (featurep :cygwin) " lisp500.imp" "")))
+				".c lisp801.lib")))
+    (let ((end (if (featurep :cygwin) " lisp801.imp" "")))
       (defun run-cc (basename)
 	(run-program "/bin/sh" "sh" "-c"
 		     (conc-string "cc -fPIC -shared -g -o " basename ".so "
@@ -5217,7 +5191,7 @@
     (format *compiler-output* "0~%};~%lval symbol_package[] = {~%")
     (dolist (symbol (reverse (compilation-symbols *compilation*)))
       (format *compiler-output* "~A,~%"
-	      (gethash (symbol-package symbol) package-hash)))
+	      (or (gethash (symbol-package symbol) package-hash) -1)))
     (format *compiler-output* "0~%};~%lval klass[] = {~%")
     (dolist (class (reverse (compilation-classes *compilation*)))
       (format *compiler-output* "~A,~%"
@@ -5258,23 +5232,23 @@
       (:symbol (conc-string "symbol[" (integer-string index 10) "]"))
       (:class (conc-string "klass[" (integer-string index 10) "]"))
       (:immediate (integer-string index 10))
-      (:cons (conc-string "(lval)value+"
-			  (integer-string (+ 1 (* 4 index)) 10)))
-      (:value (conc-string "(lval)value+"
-			   (integer-string (+ 2 (* 4 index)) 10)))
-      (:opaque (conc-string "(lval)opaque+"
-			    (integer-string (+ 3 (* 4 index)) 10))))))
+      (:cons (conc-string "((lval)(value+"
+			  (integer-string index 10) ")+1)"))
+      (:value (conc-string "((lval)(value+"
+			   (integer-string index 10) ")+2)"))
+      (:opaque (conc-string "((lval)(opaque+"
+			    (integer-string index 10) ")+3)")))))
 (defun intern-constant-lval (value)
   (multiple-value-bind (index type)
       (intern-constant value)
     (case type
-      (:package (+ 3221225472 2 (* 4 index)))
-      (:symbol (+ 2147483648 2 (* 4 index)))
-      (:class (+ 1073741824 2 (* 4 index)))
+      (:package (+ (* 3 72057594037927936) 2 (* 8 index)))
+      (:symbol (+ (* 2 72057594037927936) 2 (* 8 index)))
+      (:class (+ (* 1 72057594037927936) 2 (* 8 index)))
       (:immediate index)
-      (:cons (+ 1 (* 4 index)))
-      (:value (+ 2 (* 4 index)))
-      (:opaque (+ 3 (* 4 index))))))
+      (:cons (+ 1 (* 8 index)))
+      (:value (+ 2 (* 8 index)))
+      (:opaque (+ 3 (* 8 index))))))
 (defun intern-constant (value)
   (cond
     ((= (ldb '(2 . 0) (ival value)) 0)
@@ -5371,9 +5345,16 @@
   (some #'function-upward-funarg-p (user-obstacles user)))
 (defun binding-upward-funarg-p (binding)
   (some #'user-upward-funarg-p (binding-users binding)))
+(defun closure-reference-p (user)
+  (> (length (user-obstacles user))
+     (if (eq (aref (aref user 1) 0) 'lambda-let) 1 0)))
+(defun special-variable-p (symbol)
+  (and symbol (symbolp symbol) (= (ldb '(1 . 2) (iref symbol 8)) 1)))
 (defun transform-function (lambda-list body environment)
   (let ((transformed-lambda-list nil))
     (dolist (elem lambda-list)
+      (when (or (member elem lambda-list-keywords) (special-variable-p elem))
+	(error "can not compile lambda list ~S" lambda-list))
       (if (member elem lambda-list-keywords)
 	  (push elem transformed-lambda-list)
 	  (if (consp elem)
@@ -5472,10 +5453,14 @@
 	(setf (aref function 3) (aref bind-fn 3))))
     (setf (aref binding 2) (transform-progn forms environment))
     binding))
+(defun lexical-bind (bind)
+  (when (or (not (consp bind)) (special-variable-p (car bind)))
+    (error "can not compile binding ~S" bind))
+  bind)
 (deftransform let (bindings &rest forms)
   (labels ((descend-bind (bindings new-env)
 	     (if bindings
-		 (let* ((bind (car bindings))
+		 (let* ((bind (lexical-bind (car bindings)))
 			(binding (vector 'let
 					 (transform (cadr bind) environment)
 					 nil nil nil)))
@@ -5488,7 +5473,7 @@
 (deftransform let* (bindings &rest forms)
   (labels ((descend-bind (bindings new-env)
 	     (if bindings
-		 (let* ((bind (car bindings))
+		 (let* ((bind (lexical-bind (car bindings)))
 			(binding (vector 'let
 					 (transform (cadr bind) new-env)
 					 nil nil nil)))
@@ -5583,14 +5568,22 @@
       (let* ((operator (car form))
 	     (arguments (cdr form))
 	     (transform (gethash operator *transforms*)))
+	(when (or (not (symbolp operator)) (eq operator 'declare)
+		  (and (not transform) (special-operator-p operator)))
+	  (error "can not compile ~S" operator))
 	(if transform
 	    (apply transform environment arguments)
-	    (let ((binding (binding environment (list 'function operator)))
-		  (targs (transform-progn arguments environment)))
+	    (multiple-value-bind (binding obstacles)
+		(binding environment (list 'function operator)
+			 *stack-obstacles*)
+	      (when (and binding obstacles)
+		(error "can not compile closure over ~S" operator))
 	      (if binding
 		  (if (consp binding)
 		      (transform (funcall (car binding) form) environment)
-		      (let ((reference (vector 'funcall-local binding targs
+		      (let ((reference (vector 'funcall-local binding
+					       (transform-progn arguments
+								environment)
 					       environment)))
 			(push reference (binding-users binding))
 			reference))
@@ -5598,8 +5591,9 @@
 		      (macroexpand-1 form)
 		    (if expandedp
 			(transform form environment)
-			(vector 'funcall-global operator targs)))))))
-      (if (symbolp form)
+			(vector 'funcall-global operator
+				(transform-progn arguments environment))))))))
+      (if (and (symbolp form) form (not (eq form t)) (not (keywordp form)))
 	  (multiple-value-bind (binding obstacles)
 	      (binding environment form *stack-obstacles*)
 	    (if binding
@@ -5643,9 +5637,10 @@
   (incf stack-height)
   (write-c (aref intermediate 2) stack-height frame-height stack-height)
   (write-receive receiver frame-height)
-  (format *compiler-output* "o2a(~A)[4]=f[~A];~%"
-	  (intern-constant-string (aref intermediate 1))
-	  (- stack-height frame-height)))
+  (let ((symbol (intern-constant-string (aref intermediate 1)))
+	(value (- stack-height frame-height)))
+    (format *compiler-output* "o2a(~A)[4]=f[~A];~%wb(o2a(~A)+4, f[~A]);~%"
+	    symbol value symbol value)))
 (defwrite-c flet
   (dolist (function (aref intermediate 1))
     (setf (binding-height function) (incf stack-height))
@@ -5673,7 +5668,7 @@
 	    (- stack-height frame-height)))
   (let ((arg-height (+ 2 stack-height)))
     (dolist (arg (aref intermediate 2))
-      (write-c arg stack-height frame-height arg-height)
+      (write-c arg (- arg-height 1) frame-height arg-height)
       (incf arg-height)))
   (write-receive receiver frame-height)
   (format *compiler-output* "call(f~A, ~A, ~A);~%"
@@ -5693,7 +5688,7 @@
 	  (- (binding-height (aref intermediate 1)) frame-height))
   (let ((arg-height (+ 2 stack-height)))
     (dolist (arg (aref intermediate 2))
-      (write-c arg stack-height frame-height arg-height)
+      (write-c arg (- arg-height 1) frame-height arg-height)
       (incf arg-height))
     (write-receive receiver frame-height)
     (format *compiler-output* "F~A(f+~A, f+~A);~%"
@@ -5737,8 +5732,10 @@
      (format *compiler-output* "}~%"))
    (compilation-output *compilation*))
   (write-receive receiver frame-height)
-  (format *compiler-output* "ma(f,5,212,ms(f,3,212,F~A,0,-1),0,0,0,0);~%"
-	  (aref intermediate 5)))
+  (format *compiler-output* "ma(f,5,212,ms(f,3,212,F~A,~A,~A),0,0,0,0);~%"
+	  (aref intermediate 5)
+	  (length (aref intermediate 1))
+	  (length (aref intermediate 1))))
 (defwrite-c let
   (incf stack-height)
   (setf (binding-height intermediate) stack-height)
@@ -5748,6 +5745,8 @@
 (defwrite-c progn
   (write-c-progn (aref intermediate 1) stack-height frame-height receiver))
 (defwrite-c reference
+  (when (closure-reference-p intermediate)
+    (error "can not compile closure"))
   (when receiver
     (write-receive receiver frame-height)
     (format *compiler-output* "f[~A];~%"
@@ -5761,6 +5760,8 @@
   (format *compiler-output* "dbgr(f, 8, ~A, 0);~%"
 	  (intern-constant-string (aref intermediate 1))))
 (defwrite-c setq
+  (when (closure-reference-p intermediate)
+    (error "can not compile closure"))
   (write-c (aref intermediate 3) stack-height frame-height
 	   (binding-height (aref intermediate 1))))
 (defwrite-c tag
@@ -5801,6 +5802,26 @@
 	(finish-compilation (with-output-to-string (*compiler-output*)
 			      (write-c (transform val))))))
     (run-cc basename)))
+(defun compile-unit (source basename)
+  (let ((forms nil))
+    (load source #'(lambda (form) (push form forms)))
+    (with-open-file (*compiler-output* (conc-string basename ".c")
+				       :direction :output)
+      (let ((*compilation* (start-compilation)))
+	(finish-compilation
+	 (with-output-to-string (init)
+	   (dolist (form (reverse forms))
+	     (when (and (consp form) (eq (car form) 'defmacro)
+			(not (fboundp (cadr form))))
+	       (eval form))
+	     (write-string
+	      (or (ignore-errors
+		   (with-output-to-string (*compiler-output*)
+		     (write-c (transform form))))
+		  (with-output-to-string (*compiler-output*)
+		    (write-c (transform `(eval ',form)))))
+	      init))))))
+    (run-cc basename)))
 (defun test-transform (val)
   (let ((*compilation* (start-compilation)))
     (transform val)))
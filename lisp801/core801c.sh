@@ -0,0 +1,28 @@
+#!/bin/bash
+# Compiles core801.lisp to the C unit core801c.c and core801c.so, then
+# checks that lisp801 with the unit loaded by fasl, instead of
+# core801.lisp, passes tests801.lisp and runs format and CLOS.
+# Usage, from lisp801/: ./core801c.sh [binary]
+# Without a binary, lisp801 is built with -rdynamic first.
+b=${1:-./lisp801}
+if [ -z "$1" ]; then
+    cc -O2 -rdynamic -o lisp801 lisp801.c -lm -ldl -lpthread || exit 1
+fi
+f=${TMPDIR:-/tmp}/core801c.lisp
+echo '(compile-unit "core801.lisp" "core801c")' > $f
+$b core801.lisp $f < /dev/null > /dev/null 2>&1
+[ -f core801c.so ] || { echo "core801c.so not built"; exit 1; }
+echo '(fasl "./core801c.so")' > $f
+r=$($b $f tests801.lisp < /dev/null 2> /dev/null | tr -d '\0')
+echo '(defclass pt () ((x :initarg :x :reader pt-x)))
+(defmethod area ((p pt)) (* (pt-x p) (pt-x p)))
+(print (list (format nil "~A-~D" (quote a) 42)
+             (area (make-instance (quote pt) :x 3))
+             (handler-case (error "e") (error () 7))))' > ${f}2
+c=$($b $f ${f}2 < /dev/null 2> /dev/null | tr -d '\0')
+rm -f $f ${f}2
+echo "$r$c"
+case "$r$c" in
+    *OK*'("A-42" 9 7)'*) ;;
+    *) exit 1 ;;
+esac
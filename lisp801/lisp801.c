@@ -11,6 +11,7 @@
 #include <math.h>
 #include <setjmp.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,15 +26,26 @@
 #define X __declspec(dllexport)
 #else
 #define X
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <dlfcn.h>
 #include <sys/utsname.h>
+#include <pthread.h>
+#include <sched.h>
 #endif
 
 #ifndef countof
 #define countof(x) (sizeof(x)/sizeof((x)[0]))
+#endif
+
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p)
 #endif
 
  /* TODO: forget about windows and use stdbool? */
@@ -132,12 +144,22 @@ typedef lint lval;
 #define LVAL_IREF_FUNCTION_SUBTYPE              (212)
 #define LVAL_IREF_SYMBOL_SUBTYPE                (20)
 #define LVAL_IREF_SIMPLE_VECTOR_SUBTYPE         (116)
+#define LVAL_IREF_ARRAY_SUBTYPE                 (148)
 #define LVAL_IREF_PACKAGE_SUBTYPE               (180)
+#define LVAL_IREF_CODE_SUBTYPE                  (244)
 
 #define LVAL_JREF_SIMPLE_STRING_SUBTYPE         (20)
 #define LVAL_JREF_DOUBLE_SUBTYPE                (84)
+#define LVAL_JREF_BIGNUM_SUBTYPE                (148)
 #define LVAL_JREF_BIT_VECTOR_SUBTYPE            (116)
 
+/**
+ * Free holes of four words and more on the allocator's size class lists:
+ * [0] holds the size like an iref header, [1] is this subtype and [2]
+ * links the next hole. Two word holes are [next, 0] and read as conses.
+ */
+#define LVAL_FREE_SUBTYPE                       (252)
+
 #define LVAL_JREF_SIZE_BIT_SHIFT                (6)
 
 #define LVAL_IREF_SIZE_BIT_SHIFT                (8)
@@ -194,6 +216,10 @@ int sp(lval o) {
     return (o & LVAL_TYPE_MASK) == LVAL_JREF_TYPE;
 }
 
+int nodep(lval x) {
+    return ap(x) && o2a(x)[1] == LVAL_IREF_CODE_SUBTYPE;
+}
+
 struct symbol_init {
     const char* name;
     lval(*fun) ();
@@ -211,12 +237,13 @@ extern struct symbol_init symi[];
 #define U g[-3]
 #define V g[-4]
 #define W g[-5]
-#define NF(n) lval *g; g=f+n+3; f[1]=0; g[-1]=(n<<5)|16; *g = *f;
+/* the slots are scanned by the collector, so they must not hold stale values */
+#define NF(n) lval *g; g=f+n+3; f[1]=0; memset(f+2, 0, (n)*sizeof(lval)); g[-1]=(n<<5)|16; *g = *f;
 #define E *f
 #define NE *g
 
 lval car(lval c) {
-    return (c & 3) == 1 ? o2c(c)[0] : LVAL_NIL;
+    return (c & 3) == 1 ? o2c(c)[0] & ~LVAL_GCM_BIT : LVAL_NIL;
 }
 
 lval cdr(lval c) {
@@ -241,12 +268,18 @@ lval cddr(lval c) {
     return cdr(cdr(c));
 }
 
+void wb(lval*, lval);
+
 lval set_car(lval c, lval val) {
-    return o2c(c)[0] = val;
+    lval* p = o2c(c);
+    *p = val | (*p & LVAL_GCM_BIT);
+    wb(p, val);
+    return val;
 }
 
 lval set_cdr(lval c, lval val) {
-    return o2c(c)[1] = val;
+    wb(o2c(c) + 1, o2c(c)[1] = val);
+    return val;
 }
 
 lval evca(lval*, lval);
@@ -277,1633 +310,5513 @@ st:
     return o2a(sym) + 4 + type;
 }
 
-lval* memory;
-lval* memf;
-int memory_size;
+/**
+ * The heap is a chain of segments of at most SEG_WORDS, sorted by address.
+ * It starts with memory_size bytes, grows when a full collection leaves
+ * less than a quarter of it free, and gives empty segments back when more
+ * than three quarters are free. memory_max limits the total size, 0 means
+ * no limit.
+ */
+#define SEG_MAX         (1024)
+#define SEG_WORDS       (1024 * 1024)
+
+struct segment {
+    lval* lo;
+    lval* hi;
+    unsigned char* bits;
+    int pin;
+} segs[SEG_MAX];
+int segc;
+lint heap_words;
+lint memory_size = 8 * 2048 * 1024;
+lint memory_max;
+lint gc_pause;
+lint gc_threads = 1;
+lint stack_size = 4 * 64 * 1024;
+lint stream_buffer = 64 * 1024;
 lval* stack;
+
+/**
+ * Objects of LARGE_MIN words and more get a malloc block of their own,
+ * after a link to the next one and the block size, whose bit 0 is the
+ * incremental mark. lyoung lists the ones allocated since the last
+ * collection, lold the survivors. llo and lhi bound the blocks ever
+ * allocated.
+ */
+#define LARGE_MIN       (4096)
+
+lval* lyoung;
+lval* lold;
+lval* llo;
+lval* lhi;
+lint large_words;
+
 lval xvalues = 8;
 lval dyns = 0;
 jmp_buf top_jmp;
+
+/**
+ * The value of a non-local exit. setjmp returns an int, which can not
+ * hold an lval on 64-bit machines, so longjmp passes 1 and the value goes
+ * here.
+ */
+lval jmpv;
+#define LJMP(j, v) (jmpv = (v), longjmp(j, 1))
+#define SJMP(j) (setjmp(j) ? jmpv : 0)
 lval pkg;
 lval pkgs;
 lval kwp = 0;
 
-void gcm(lval v) {
-    lval* t;
+/**
+ * Constants of the units loaded by fasl, kept alive for their code.
+ */
+lval fasls;
+
+/**
+ * Counts the times objects were moved, so that the hash tables which
+ * hashed them by address know to hash them again.
+ */
+lint moved;
+
+/**
+ * Allocation cursor.
+ * </p>
+ * Objects are bump allocated from the zeroed hole [memp, meml) in segment
+ * mems. Collections
+ * (but gccompact) never move or free anything, they only set the mark bit of the survivors,
+ * and the bit stays set: a marked object is old. So every unmarked block in
+ * front of the cursor is garbage, and when the hole is used up the cursor
+ * moves on to the next run of unmarked blocks and zeroes it. Whatever the
+ * cursor passed since the last collection (at memy) is young, so it must
+ * not lap memy before the next collection: memw counts the segments it
+ * entered since then.
+ * </p>
+ * A nursery collection marks from the roots and the remembered set and
+ * stops at old objects, so its cost is proportional to the live young
+ * objects, not to the heap size. A full collection clears all marks first.
+ *
+ * @see #gcn
+ * @see #gc
+ */
+#define NURSERY_SIZE    (256 * 1024)
+
+lval* memp;
+lval* meml;
+lval* memh;
+lval* memy;
+int mems;
+int memw;
+lint nursery_size = NURSERY_SIZE;
+lint nursery_used;
+
+/**
+ * Words marked by the current collection.
+ */
+lint memlive;
+
+/**
+ * Remembered set: heap slots written with young objects since the last
+ * collection. On overflow the next collection is a full one.
+ */
+#define REMSET_MAX      (64 * 1024)
+
+lval* remset[REMSET_MAX];
+int remc;
+int removf;
+
+/**
+ * Values which are only held by C code while it allocates.
+ */
+#define GC_ROOTS        (16)
+
+lval gcroots[GC_ROOTS];
+int gcrootc;
+
+/**
+ * Incremental full collection, used when gc_pause (microseconds) is set.
+ * </p>
+ * The mark bit of old objects stays set, so this collection marks in a
+ * side bitmap per segment instead. It only has to find which old objects
+ * are dead: young ones are the business of the nursery collections. Each
+ * nursery collection runs a slice of it, bounded by gc_pause but doing at
+ * least GC_WORK words of work per word allocated since the last one, so
+ * that the collection keeps up with allocation:
+ * <ul>
+ * <li>1, marking: the roots are shaded, then gray objects (bit set, on
+ * istk) are scanned. The write barrier shades the old objects stored into
+ * the heap, and the nursery collection pushes the objects it promotes.
+ * When istk is empty the roots are shaded again and istk drained.</li>
+ * <li>2, sweeping: old objects without their bit lose their mark bit and
+ * so become free for the allocation cursor. A slice only stops at a block
+ * which keeps its mark, as the cursor and the hole lists may reuse any
+ * free run before the next slice.</li>
+ * </ul>
+ * A full collection aborts it. A new one starts when half of what the
+ * last collection left free, ilast being what it found live, is used up.
+ */
+#define GC_WORK         (4)
+
+int gcphase;
+lint ilive;
+lint ilast;
+lval* istk;
+lint istkc;
+lint istkn;
+int sweeps;
+lval* sweepp;
+
+lint usec() {
+#ifdef _WIN32
+    LARGE_INTEGER c;
+    LARGE_INTEGER q;
+    QueryPerformanceCounter(&c);
+    QueryPerformanceFrequency(&q);
+    return c.QuadPart * 1000000 / q.QuadPart;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+#endif
+}
+
+/**
+ * Returns the segment of the heap pointer t, NULL for large objects.
+ */
+struct segment* sfind(lval* t) {
+    int lo = 0;
+    int hi = segc - 1;
     int i;
-st:
-    t = (lval*)(v & ~3);
-    if (v & 3 && !(t[0] & 4)) {
-        t[0] |= 4;
-        switch (v & 3) {
-        case 1:
-            gcm(t[0] - 4);
-            v = t[1];
-            goto st;
-        case 2:
-            gcm(t[1] - 4);
-            if (t[0] >> 8) {
-                for (i = 1; i < t[0] >> 8; i++) {
-                    gcm(t[i + 1]);
-                }
-                v = t[i + 1];
-                goto st;
-            }
+    while (lo <= hi) {
+        i = (lo + hi) / 2;
+        if (t < segs[i].lo) {
+            hi = i - 1;
+        }
+        else if (t >= segs[i].hi) {
+            lo = i + 1;
+        }
+        else {
+            return segs + i;
         }
     }
+    return NULL;
 }
 
-lval gc(lval* f) {
+/**
+ * Sets the bitmap bit of object v, returns 0 if it was set already.
+ */
+int bset(lval v) {
+    lval* t = (lval*)(v & ~3);
+    struct segment* s = sfind(t);
     lint i;
-    lval* m;
-    lint l;
-    int u = 0;
-    lint ml = 0;
-    printf(";garbage collecting...\n");
-    while (memf) {
-        lval* n = (lval*)memf[0];
-        memset(memf, 0, sizeof(lval) * memf[1]);
-        memf = (lval*)n;
-    }
-    gcm(xvalues);
-    gcm(pkgs);
-    gcm(dyns);
-    for (; f > stack; f--) {
-        if ((*f & 3) && (*f < memory ||
-            *f >(memory + memory_size / sizeof(lval)))) {
-            printf("%llx\n", *f);
-        }
-        gcm(*f);
-    }
-    memf = 0;
-    m = memory;
-    i = 0;
-    while (m < (memory + memory_size / sizeof(lval))) {
-        l = ((m[1] & 4 ? m[0] >> 8 : 0) + 1) & ~1;
-        if (m[0] & 4) {
-            if (u) {
-                m[-ml] = (lval)memf;
-                m[1 - ml] = ml;
-                memf = m - ml;
-                u = 0;
-                i += ml;
-            }
-        }
-        else {
-            if (!u) {
-                ml = 0;
-            }
-            ml += l + 2;
-            u = 1;
+    if (!s) {
+        if (t[-1] & 1) {
+            return 0;
         }
-        m[0] &= ~4;
-        m += l + 2;
+        t[-1] |= 1;
+        return 1;
     }
-    if (u) {
-        m[-ml] = (lval)memf;
-        m[1 - ml] = ml;
-        memf = m - ml;
-        i += ml;
+    i = (t - s->lo) >> 1;
+    if (s->bits[i >> 3] & (1 << (i & 7))) {
+        return 0;
     }
-    printf(";done. %Id free.\n", i);
-    return 0;
+    s->bits[i >> 3] |= 1 << (i & 7);
+    return 1;
 }
 
 /**
- * Allocates n lval units in the context memory and returns it.
- * Returns NULL if no free cells available.
- * The caller party may use n lval blocks if the returned pointer is not null.
+ * Doubles the growable stack s of *n entries.
  */
-lval* m0(lint n) {
-    lval* m = memf; /* start searching from the first memory sub block */
-    lval* p = 0; /* previous memory sub block */
-
-    n = (n + 1) & ~1; /* round odd size to the greater even */
-
-    /* iterate over the available sub blocks */
-    for (; m; m = (lval*)m[0]) {
-        if (n <= m[1]) {
-            /* size requested fits into the current sub block */
-            if (m[1] == n) {
-                if (p) {
-                    p[0] = m[0];
-                }
-                else {
-                    /* allocate the entire sub block, but update memf pointer */
-                    memf = (lval*)m[0];
-                }
-            }
-            else {
-                m[1] -= n;
-                m += m[1];
-            }
-            return m;
-        }
-
-        p = m;
+lval* sgrow(lval* s, lint* n) {
+    *n = *n ? *n * 2 : 4096;
+    if (!(s = realloc(s, *n * sizeof(lval)))) {
+        fprintf(stderr, "Out of memory");
+        exit(-1);
     }
+    return s;
+}
 
-    return NULL;
+void ipush(lval v) {
+    if (istkc == istkn) {
+        istk = sgrow(istk, &istkn);
+    }
+    istk[istkc++] = v;
 }
 
-#define GC_MAX_RETRY    (3)
+void ishade(lval v) {
+    if (v & 3 && *(lval*)(v & ~3) & LVAL_GCM_BIT && bset(v)) {
+        ipush(v);
+    }
+}
 
 /**
- * Allocates n lval units, applies gcm to the mgc lvals in variadic params.
- * Never returns NULL.
+ * Write barrier, to be called after storing v into the heap slot p.
+ * Slots in the current hole belong to young objects and need no entry.
  */
-lval* cm0(lval* g, lint n) {
-    lval* m;
-    int i;
-    for (i = 0; i < GC_MAX_RETRY; ++i) {
-        m = m0(n);
-        if (m) {
-            break;
-        }
-        gc(g);
+void wb(lval* p, lval v) {
+    if (gcphase == 1) {
+        ishade(v);
     }
-    /* Recheck pointer after gc */
-    if (!m) {
-        fprintf(stderr, "Out of memory");
-        exit(-1);
+    if (v & 3 && !(*(lval*)(v & ~3) & LVAL_GCM_BIT)
+        && !(p >= memh && p < memp)) {
+        if (remc < REMSET_MAX) {
+            remset[remc++] = p;
+        }
+        else {
+            removf = 1;
+        }
     }
-    return m;
 }
 
 /**
- * Allocates iref
+ * Size in words of the heap block at m, header included.
  */
-lval* ma0(lval* g, lint n) {
-    lval* m = cm0(g, n + 2LL);
-    *m = n << LVAL_IREF_SIZE_BIT_SHIFT;
-    return m;
+lint hsize(lval* m) {
+    return m[1] & 4 ? (((m[0] >> 8) + 1) & ~1) + 2 : 2;
 }
 
 /**
- * Allocates jref
+ * Mark stack: objects whose mark bit has yet to be checked. It grows as
+ * needed, so marking deep structures does not use the C stack. Pushing
+ * prefetches the object, which is then in cache when it gets popped.
  */
-lval* ms0(lval* g, lint n) {
-    lval* m = cm0(g, (n+12LL)/4LL);
-    *m = (n + 4) << LVAL_JREF_SIZE_BIT_SHIFT;
-    return m;
+lval* mstk;
+lint mstkc;
+lint mstkn;
+
+void mpush(lval v) {
+    if (v & 3) {
+        if (mstkc == mstkn) {
+            mstk = sgrow(mstk, &mstkn);
+        }
+        PREFETCH((lval*)(v & ~3));
+        mstk[mstkc++] = v;
+    }
 }
 
-lval* mb0(lval* g, lint n) {
-    lval* m = cm0(g, (n + 95LL) / 32LL);
-    *m = (n + 31) << 3;
-    return m;
+void gcm(lval v) {
+    lval* t;
+    lint i;
+    lint n;
+    mpush(v);
+    while (mstkc) {
+        v = mstk[--mstkc];
+        /* the cdr and the last slot are followed without a push */
+        for (;;) {
+            t = (lval*)(v & ~3);
+            if (!(v & 3) || t[0] & 4) {
+                break;
+            }
+            t[0] |= 4;
+            if (gcphase) {
+                bset(v);
+                if (gcphase == 1) {
+                    ipush(v);
+                }
+            }
+            if ((v & 3) == 1) {
+                memlive += 2;
+                mpush(t[0] - 4);
+                v = t[1];
+                continue;
+            }
+            memlive += hsize(t);
+            if ((v & 3) == 3) {
+                break;
+            }
+            mpush(t[1] - 4);
+            if (!(n = t[0] >> 8)) {
+                break;
+            }
+            for (i = 1; i < n; i++) {
+                mpush(t[i + 1]);
+            }
+            v = t[n + 1];
+        }
+    }
 }
 
-X lval ma(lval* g, lint n, ...) {
-    va_list v;
-    int i;
-    lval* m = cm0(g, n + 2LL);
-    *m = n << 8;
-    va_start(v, n);
-    for (i = -1; i < n; i++) {
-        m[2 + i] = va_arg(v, lval);
-    }
-    va_end(v);
-    return a2o(m);
+/**
+ * Whether v points into a segment or between llo and lhi, which is as
+ * close as the stray root diagnostic of gcroot needs to get without
+ * walking the large objects.
+ */
+int inheap(lval v) {
+    lval* t = (lval*)(v & ~3);
+    return sfind(t) || (t >= llo && t < lhi);
 }
 
-X lval ms(lval* g, lint n, ...) {
-    va_list v;
+void gcroot(lval* f, void (*m)(lval)) {
     int i;
-    lval* m = cm0(g, n + 2);
-    *m = n << 8;
-    va_start(v, n);
-    for (i = -1; i < n; i++) {
-        m[2 + i] = va_arg(v, lval);
+    m(xvalues);
+    m(pkgs);
+    m(pkg);
+    m(kwp);
+    m(dyns);
+    m(fasls);
+    for (i = 0; i < gcrootc; i++) {
+        m(gcroots[i]);
+    }
+    for (; f > stack; f--) {
+        if ((*f & 3) && !inheap(*f)) {
+            fprintf(stderr, "%llx\n", (unsigned long long)*f);
+        }
+        m(*f);
     }
-    va_end(v);
-    return s2o(m);
 }
 
-double o2d(lval o) {
-    return sp(o) ? *(double*)(o2s(o) + 2) : o >> 5;
-}
+/**
+ * Holes the cursor passed without using them, by size class: exactly 2, 4,
+ * 6 and 8 words (conses and doubles fit the first two), then one class per
+ * power of two. The lists are dropped at each collection, as the next lap
+ * finds the holes again.
+ */
+#define HOLE_CLASSES    (13)
 
-lval d2o(lval* g, double d) {
-    lval x = (lval)d << 5 | 16;
-    lval* a;
-    if (o2d(x) == d) {
-        return x;
-    }
+lval* holes[HOLE_CLASSES];
 
-    a = ms0(g, 2);
-    a[1] = 84;
-    *(double*)(a + 2) = d;
-    return s2o(a);
+int hclass(lint n) {
+    int c = 1;
+    if (n <= 8) {
+        return (int)n / 2 - 1;
+    }
+    for (; n > 1 && c < HOLE_CLASSES - 1; n >>= 1) {
+        c++;
+    }
+    return c;
 }
 
-lint o2i(lval o) {
-    return (lint)o2d(o);
+lval** hnext(lval* h) {
+    return h[1] ? (lval**)h + 2 : (lval**)h;
 }
 
-uintptr_t o2u(lval o) {
-    return (uintptr_t)o2d(o);
+/**
+ * Files the hole of n words at h.
+ */
+void hfile(lval* h, lint n) {
+    lval** l = holes + hclass(n);
+    if (n > 2) {
+        h[0] = (n - 2) << 8;
+        h[1] = LVAL_FREE_SUBTYPE;
+    }
+    else if (n == 2) {
+        h[1] = 0;
+    }
+    else {
+        return;
+    }
+    *hnext(h) = *l;
+    *l = h;
 }
 
 /**
- * Creates cons cell of a and b.
- * Stack pointer f is used for garbage collecting.
+ * Takes n words from the first filed hole big enough, zeroed. Only the
+ * first few holes of n's own class are tried, as any hole of a higher
+ * class but the last is big enough.
  */
-lval cons(lval* g, lval a, lval d) {
-    lval* c = m0(2);
-    if (!c) {
-        gcm(a);
-        gcm(d);
-        gc(g);
-        c = m0(2);
-        if (!c) {
-            fprintf(stderr, "Out of memory");
-            exit(-1);
+#define HOLE_TRIES      (4)
+
+lval* hpop(lint n) {
+    int c = hclass(n);
+    lval** p;
+    lval* h;
+    lint l;
+    int t;
+    for (; c < HOLE_CLASSES; c++) {
+        for (p = holes + c, t = 0; (h = *p) && t < HOLE_TRIES; p = hnext(h), t++) {
+            l = h[1] ? hsize(h) : 2;
+            if (l >= n) {
+                *p = *hnext(h);
+                memset(h, 0, n * sizeof(lval));
+                hfile(h + n, l - n);
+                return h;
+            }
         }
     }
-    c[0] = a;
-    c[1] = d;
-    return c2o(c);
+    return NULL;
 }
 
-int string_equal_do(lval a, lval b) {
-    int i;
-    for (i = 0; i < o2s(a)[0] / 64 - 4; i++) {
-        if (o2z(a)[i] != o2z(b)[i]) {
-            return 0;
-        }
+lval* mlarge(lint n) {
+    lval* m;
+    if ((memory_max && (heap_words + large_words + n + 2) * (lint)sizeof(lval) > memory_max)
+        || !(m = calloc(n + 2, sizeof(lval)))) {
+        return NULL;
     }
-    return 1;
+    m[0] = (lval)lyoung;
+    m[1] = n + 2;
+    lyoung = m;
+    if (!llo || m < llo) {
+        llo = m;
+    }
+    if (m + n + 2 > lhi) {
+        lhi = m + n + 2;
+    }
+    large_words += n + 2;
+    nursery_used += n;
+    return m + 2;
 }
 
-int string_equal(lval a, lval b) {
-    return a == b || (sp(a) && sp(b) &&
-        o2s(a)[1] == 20 && o2s(b)[1] == 20 && o2s(a)[0] == o2s(b)[0]
-        && string_equal_do(a, b));
+/**
+ * Frees the unmarked large objects of list l and moves the others to lold.
+ */
+void lsweep(lval* l) {
+    lval* n;
+    for (; l; l = n) {
+        n = (lval*)l[0];
+        if (l[2] & 4) {
+            l[0] = (lval)lold;
+            lold = l;
+        }
+        else {
+            large_words -= l[1] & ~1;
+            free(l);
+        }
+    }
 }
 
-lval argi(lval a, lval* b) {
-    if (cp(a)) {
-        *b = cdr(a);
-        return car(a);
-    }
-    *b = 0;
-    return a;
+/**
+ * Starts a new allocation lap at the cursor. What the collection left in
+ * the hole before it is old, so the write barrier must remember stores
+ * into it.
+ */
+void gclap() {
+    memy = memh = memp;
+    memw = 0;
+    nursery_used = 0;
+    remc = 0;
+    removf = 0;
+    memset(holes, 0, sizeof(holes));
+    lsweep(lyoung);
+    lyoung = 0;
 }
 
-lval rest(lval* h, lval* g) {
-    lval* f = h - 1;
-    lval r = 0;
-    for (; f >= g; f--) {
-        r = cons(h, *f, r);
+/**
+ * Adds a zeroed segment of k words, returns NULL if the heap may not grow.
+ */
+lval* mseg(lint k) {
+    lval* m = NULL;
+    unsigned char* b = NULL;
+    int i;
+    if (segc == SEG_MAX
+        || (memory_max && (heap_words + k) * (lint)sizeof(lval) > memory_max)
+        || !(m = calloc(k, sizeof(lval))) || !(b = calloc(k / 16 + 1, 1))) {
+        free(m);
+        return NULL;
     }
-    return r;
+    for (i = segc++; i > 0 && segs[i - 1].lo > m; i--) {
+        segs[i] = segs[i - 1];
+    }
+    segs[i].lo = m;
+    segs[i].hi = m + k;
+    segs[i].bits = b;
+    segs[i].pin = 0;
+    heap_words += k;
+    return m;
 }
 
-lval args(lval*, lval, lint);
-
-lval argd(lval* f, lval n, lval a) {
-    if (cp(n)) {
-        lval* h = f;
-        for (; a; a = cdr(a)) {
-            *++h = car(a);
+/**
+ * Adds segments for n words and moves the cursor to the first one.
+ * Only valid right after a collection, as it starts a new lap.
+ * Returns 0 if the heap may not grow at all.
+ */
+int mgrow(lint n) {
+    lval* m;
+    lval* f = NULL;
+    lint k;
+    for (n = (n + 1) & ~1; n > 0; n -= k) {
+        k = n < SEG_WORDS ? n : SEG_WORDS;
+        if (!(m = mseg(k))) {
+            break;
+        }
+        if (!f) {
+            f = m;
         }
-        ++h;
-        *++h = *f;
-        return args(f, n, h - f - 2);
     }
-    return cons(f, cons(f, n, a), *f);
+    if (!f) {
+        return 0;
+    }
+    nursery_size = heap_words / 4 < NURSERY_SIZE ? heap_words / 4 : NURSERY_SIZE;
+    mems = (int)(sfind(f) - segs);
+    memh = meml = memp = f;
+    gclap();
+    return 1;
 }
 
-lval args(lval* f, lval m, lint c) {
-    lval* g = f + 1;
-    lval* h = f + c + 2;
-    int t;
-    lval k, * l;
-
-st:
-    t = 0;
-    while (cp(m)) {
-        lval n = car(m);
-        m = cdr(m);
-        switch (cp(n) ? -1 : o2a(n)[7] >> 3) {
-        case 2:
-        case 3:
-            t = 1;
-            continue;
-        case 4:
-            t = 2;
-            continue;
-        case 5:
-            t = -2;
-            continue;
-        case 6:
-            t = 4;
-            continue;
-        case 7:
-            t = 5;
-            continue;
-        default:
-            switch (t) {
-            case 0:
-                if (g >= h - 1) {
-                    dbgr(g, 7, 0, h);
-                    goto st;
-                } *h = argd(h, n, *g);
-                break;
-            case 1:
-                *h = cons(h, cons(h, n, rest(h - 1, g)), *h);
-                t = -1;
-                continue;
-            case 2:
-                n = argi(n, &k);
-                *h = argd(h, n, g < h - 1 ? *g : evca(h, k));
-                break;
-            case -2:
-                n = argi(n, &k);
-                for (l = g; l < h - 1; l += 2) {
-                    if (string_equal(o2a(n)[2], o2a(*l)[2]) && o2a(*l)[9] == kwp) {
-                        k = l[1];
-                        break;
-                    }
-                }
-                *h = argd(h, n, l < h - 1 ? k : evca(h, k));
-                continue;
-            case 4:
-                *h = cons(h, cons(h, n, rest(h - 1, f + 1)), *h);
-                t = 0;
-                continue;
-            case 5:
-                *h = cons(h, cons(h, n, f[-1]), *h);
-                t = 0;
-                continue;
+/**
+ * Frees the segments without marked objects, except the one of the cursor,
+ * as long as half of the heap stays free.
+ * Only valid right after a full collection.
+ */
+void mtrim() {
+    struct segment* s;
+    lval* m;
+    lint n;
+    int j = 0;
+    for (s = segs; s < segs + segc; s++) {
+        n = heap_words - (s->hi - s->lo);
+        for (m = s->lo; m < s->hi && !(m[0] & 4); m += hsize(m));
+        if (m < s->hi || s == segs + mems || (n - memlive) * 2 < n) {
+            if (s == segs + mems) {
+                mems = j;
             }
+            segs[j++] = *s;
+        }
+        else {
+            heap_words -= s->hi - s->lo;
+            free(s->lo);
+            free(s->bits);
         }
-        g++;
-    }
-    if (m) {
-        return cons(h, cons(h, m, rest(h - 1, g)), *h);
     }
+    segc = j;
+    nursery_size = heap_words / 4 < NURSERY_SIZE ? heap_words / 4 : NURSERY_SIZE;
+}
 
-    if (g < h - 1 && t >= 0) {
-        h[-1] = (c << 5) | 16;
-        dbgr(h, 6, 0, h);
-        goto st;
+/**
+ * Clears the mark bits of the segments i, i + step, ...
+ */
+void gcclear(int i, int step) {
+    lval* m;
+    for (; i < segc; i += step) {
+        for (m = segs[i].lo; m < segs[i].hi; m += hsize(m)) {
+            m[0] &= ~4;
+        }
     }
+}
 
-    return *h;
+#ifndef _WIN32
+/**
+ * Parallel full collection, with gc_threads > 1.
+ * </p>
+ * Each marker has a private mark stack. When it holds more than two
+ * batches and the public deque of the marker is empty, a batch moves
+ * there, and markers out of work steal whole public deques. The mark bit
+ * is set with an atomic or, so that only one marker scans each object.
+ * A marker that finds no work anywhere goes idle; when all are, marking
+ * is done, since each one empties its public deque before going idle.
+ */
+#define MARKERS_MAX     (64)
+#define STEAL_BATCH     (256)
+
+struct marker {
+    pthread_t th;
+    pthread_mutex_t lock;
+    lval* v;
+    lint c;
+    lint n;
+    lval pub[STEAL_BATCH];
+    int pubc;
+    int id;
+    lint live;
+} markers[MARKERS_MAX];
+int pactive;
+lval* proots;
+lint prootc;
+lint prootn;
+
+void proot(lval v) {
+    if (v & 3) {
+        if (prootc == prootn) {
+            proots = sgrow(proots, &prootn);
+        }
+        proots[prootc++] = v;
+    }
 }
 
-lval eval_body(lval* f, lval ex) {
-    NF(1) T = 0;
-    for (; ex; ex = cdr(ex)) {
-        T = evca(g, ex);
+void ppush(struct marker* w, lval v) {
+    if (v & 3) {
+        if (w->c == w->n) {
+            w->v = sgrow(w->v, &w->n);
+        }
+        PREFETCH((lval*)(v & ~3));
+        w->v[w->c++] = v;
     }
-    return T;
 }
 
-lint map_eval(lval* f, lval ex) {
-    lval* g = (lval*) f + 3;
-    for (; ex; ex = cdr(ex), g++) {
-        g[-1] = ((g - f - 3) << 5) | 16;
-        *g = *f;
-        g[-1] = evca(g, ex);
+/**
+ * Moves the public deque of marker d into the private stack of w.
+ */
+int psteal(struct marker* w, struct marker* d) {
+    int i;
+    int k = 0;
+    if (!__atomic_load_n(&d->pubc, __ATOMIC_RELAXED)) {
+        return 0;
     }
-    return g - f - 3;
+    pthread_mutex_lock(&d->lock);
+    for (i = 0; i < d->pubc; i++, k++) {
+        ppush(w, d->pub[i]);
+    }
+    __atomic_store_n(&d->pubc, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&d->lock);
+    return k;
 }
 
-lval eval(lval* f, lval expr) {
-    NF(1) T = 0;
-    T = cons(g, expr, 0);
-    return evca(g, T);
+void pscan(struct marker* w, lval v) {
+    lval* t;
+    lval o;
+    lint i;
+    lint n;
+    for (;;) {
+        t = (lval*)(v & ~3);
+        if (!(v & 3) || (o = __atomic_fetch_or(t, 4, __ATOMIC_RELAXED)) & 4) {
+            break;
+        }
+        if ((v & 3) == 1) {
+            w->live += 2;
+            ppush(w, o);
+            v = t[1];
+            continue;
+        }
+        w->live += (((o >> 8) + 1) & ~1) + 2;
+        if ((v & 3) == 3) {
+            break;
+        }
+        ppush(w, t[1] - 4);
+        if (!(n = o >> 8)) {
+            break;
+        }
+        for (i = 1; i < n; i++) {
+            ppush(w, t[i + 1]);
+        }
+        v = t[n + 1];
+    }
 }
 
-lval rvalues(lval* g, lval v) {
-    return xvalues == 8 ? cons(g, v, 0) : xvalues;
+void* pmark(void* a) {
+    struct marker* w = a;
+    lint i;
+    int j;
+    for (i = w->id; i < prootc; i += gc_threads) {
+        ppush(w, proots[i]);
+    }
+    for (;;) {
+        while (w->c) {
+            pscan(w, w->v[--w->c]);
+            if (w->c > 2 * STEAL_BATCH && !__atomic_load_n(&w->pubc, __ATOMIC_RELAXED)) {
+                pthread_mutex_lock(&w->lock);
+                w->c -= STEAL_BATCH;
+                memcpy(w->pub, w->v + w->c, sizeof(w->pub));
+                __atomic_store_n(&w->pubc, STEAL_BATCH, __ATOMIC_RELAXED);
+                pthread_mutex_unlock(&w->lock);
+            }
+        }
+        if (psteal(w, w)) {
+            continue;
+        }
+        for (j = 0; j < gc_threads && !psteal(w, markers + j); j++);
+        if (j < gc_threads) {
+            continue;
+        }
+        __atomic_sub_fetch(&pactive, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            for (j = 0; j < gc_threads
+                && !__atomic_load_n(&markers[j].pubc, __ATOMIC_RELAXED); j++);
+            if (j < gc_threads) {
+                __atomic_add_fetch(&pactive, 1, __ATOMIC_SEQ_CST);
+                if (psteal(w, markers + j)) {
+                    break;
+                }
+                __atomic_sub_fetch(&pactive, 1, __ATOMIC_SEQ_CST);
+            }
+            else if (!__atomic_load_n(&pactive, __ATOMIC_SEQ_CST)) {
+                return NULL;
+            }
+            sched_yield();
+        }
+    }
 }
 
-lval mvalues(lval a) {
-    xvalues = a;
-    return car(a);
+void* pclear(void* a) {
+    gcclear(((struct marker*)a)->id, (int)gc_threads);
+    return NULL;
 }
 
-lval infn(lval* f, lval* h) {
-    jmp_buf jmp;
-    lval vs;
-    lval* g = h + 1;
-    lval fn = *f;
-    lint d = h - f - 1;
-    h[1] = o2a(fn)[3];
-    NE = args(f, o2a(fn)[4], d);
-    g[-1] = cons(g, dyns, ms(g, 1, 20, (lval)&jmp));
-    NE = cons(g, cons(g, cons(g, o2a(fn)[6], 64), g[-1]), NE);
-    g[-1] = (d << 5) | 16;
-    if (!(vs = (lval)setjmp(jmp))) {
-        return eval_body(g, o2a(fn)[5]);
+/**
+ * Clears the marks and marks from the roots with gc_threads threads.
+ */
+void gcpar(lval* f) {
+    int i;
+    for (i = 0; i < gc_threads; i++) {
+        markers[i].id = i;
+        pthread_create(&markers[i].th, NULL, pclear, markers + i);
+    }
+    for (i = 0; i < gc_threads; i++) {
+        pthread_join(markers[i].th, NULL);
+    }
+    prootc = 0;
+    gcroot(f, proot);
+    pactive = (int)gc_threads;
+    for (i = 0; i < gc_threads; i++) {
+        markers[i].live = 0;
+        markers[i].pubc = 0;
+        pthread_mutex_init(&markers[i].lock, NULL);
+    }
+    for (i = 0; i < gc_threads; i++) {
+        pthread_create(&markers[i].th, NULL, pmark, markers + i);
+    }
+    for (i = 0; i < gc_threads; i++) {
+        pthread_join(markers[i].th, NULL);
+        pthread_mutex_destroy(&markers[i].lock);
+        memlive += markers[i].live;
     }
-    return mvalues(car(vs));
 }
+#endif
 
-X lval call(lval* f, lval fn, uintptr_t d) {
-    lval* g = f + d + 3;
-    xvalues = 8;
-    if (o2a(fn)[1] == 20) {
-        fn = o2a(fn)[5];
+lval gc(lval* f) {
+    lval* m;
+    fprintf(stderr, ";garbage collecting...\n");
+    gcphase = 0;
+    istkc = 0;
+    for (m = lold; m; m = (lval*)m[0]) {
+        m[2] &= ~4;
     }
-
-    if (o2a(fn)[0] & 16) {
-        fn = o2a(fn)[3];
+    memlive = 0;
+#ifndef _WIN32
+    if (gc_threads > 1) {
+        gcpar(f);
     }
-    *++f = fn;
-    fn = o2a(fn)[2];
-    if (d < (uintptr_t)o2s(fn)[3]) {
-        dbgr(g, 7, 0, f);
+    else
+#endif
+    {
+        gcclear(0, 1);
+        gcroot(f, gcm);
     }
-    if (d > (uintptr_t) o2s(fn)[4]) {
-        dbgr(g, 6, 0, f);
+    m = lold;
+    lold = 0;
+    lsweep(m);
+    gclap();
+    memlive -= large_words;
+    ilast = memlive;
+    if ((heap_words - memlive) * 4 < heap_words) {
+        mgrow(heap_words / 2);
     }
-    return ((lval(*) ()) o2s(fn)[2]) (f, f + d + 1);
+    else if ((heap_words - memlive) * 4 > heap_words * 3 && segc > 1) {
+        mtrim();
+    }
+    fprintf(stderr, ";done. %lld free.\n", (long long)(heap_words - memlive));
+    return 0;
 }
 
-lval eval_quote(lval* g, lval ex) {
-    return car(ex);
+void iscan(lval v) {
+    lval* t = (lval*)(v & ~3);
+    lint i;
+    switch (v & 3) {
+    case 1:
+        ilive += 2;
+        ishade(t[0] & ~LVAL_GCM_BIT);
+        ishade(t[1]);
+        break;
+    case 2:
+        ilive += hsize(t);
+        ishade(t[1] - 4);
+        for (i = 1; i <= t[0] >> 8; i++) {
+            ishade(t[i + 1]);
+        }
+        break;
+    case 3:
+        ilive += hsize(t);
+    }
 }
 
-/* TODO: f seems redundant here */
-int specp(lval* f, lval ex, lval s) {
-    for (; ex; ex = cdr(ex)) {
-        if (ap(caar(ex)) && o2a(caar(ex))[7] == 3 << 3) {
-            lval e = cdar(ex);
-            for (; e; e = cdr(e)) {
-                if (o2a(caar(e))[7] == 4 << 3) {
-                    lval sp = cdar(e);
-                    for (; sp; sp = cdr(sp)) {
-                        if (car(sp) == s) {
-                            return 1;
-                        }
-                    }
-                }
-            }
-        }
-        else {
-            break;
+/**
+ * Scans gray objects until istk is empty, returning 1, or until the time
+ * is past e and w words were scanned, returning 0. A negative e never
+ * expires.
+ */
+int islice(lint e, lint w) {
+    lint k = 0;
+    w += ilive;
+    while (istkc) {
+        iscan(istk[--istkc]);
+        if (e >= 0 && !(++k & 255) && ilive >= w && usec() >= e) {
+            return 0;
         }
     }
-    return 0;
+    return 1;
 }
 
-void unwind(lval* f, lval c) {
-    lval e;
-    NF(0) for (; dyns != c; dyns = cdr(dyns))
-        if (ap(car(dyns))) {
-            if (o2a(car(dyns))[1] == 52) {
-                NE = o2a(car(dyns))[2];
-                eval_body(g, o2a(car(dyns))[3]);
+/**
+ * Unmarks the old objects without their bit until the time is past e and
+ * w words were swept, then stops at the next block which keeps its mark.
+ * Returns 1 when the whole heap is swept.
+ */
+int sslice(lint e, lint w) {
+    struct segment* s;
+    lval* m;
+    lint i;
+    lint k = 0;
+    int stop = 0;
+    for (; sweeps < segc; sweeps++, sweepp = NULL) {
+        s = segs + sweeps;
+        for (m = sweepp ? sweepp : s->lo; m < s->hi; m += hsize(m)) {
+            i = (m - s->lo) >> 1;
+            if (m[0] & 4 && !(s->bits[i >> 3] & (1 << (i & 7)))) {
+                m[0] &= ~4;
             }
-            else {
-                for (e = o2a(car(dyns))[2]; e; e = cdr(e)) {
-                    o2a(caar(e))[4] = cdar(e);
-                }
+            if (stop && m[0] & 4) {
+                sweepp = m;
+                return 0;
             }
+            w -= hsize(m);
+            stop = stop || (!(++k & 1023) && w <= 0 && usec() >= e);
         }
-        else {
-            o2s(car(dyns))[2] = 0;
-        }
+    }
+    return 1;
 }
 
-lval eval_let(lval* f, lval ex) {
-    lval r;
-    NF(3) T = car(ex);
-    U = E;
-    V = 0;
-    r = ma(g, 1, 84, LVAL_NIL);
-    dyns = cons(g, r, dyns);
-    for (; T; T = cdr(T)) {
-        V = evca(g, cdar(T));
-        if (o2a(caar(T))[8] & 128 || specp(g, cdr(ex), caar(T))) {
-            o2a(r)[2] = cons(g, cons(g, caar(T), V), o2a(r)[2]);
+/**
+ * Runs a slice of the incremental collection, see above, right after a
+ * nursery collection, until the time is past e and w words of work are
+ * done.
+ */
+void gcstep(lval* f, lint e, lint w) {
+    struct segment* s;
+    lval* m;
+    switch (gcphase) {
+    case 0:
+        if (memlive * 2 > heap_words + ilast) {
+            for (s = segs; s < segs + segc; s++) {
+                memset(s->bits, 0, (s->hi - s->lo) / 16 + 1);
+            }
+            for (m = lold; m; m = (lval*)m[0]) {
+                m[1] &= ~1;
+            }
+            ilive = 0;
+            gcphase = 1;
+            gcroot(f, ishade);
+            islice(e, w);
         }
-        else {
-            U = cons(g, cons(g, caar(T), V), U);
+        break;
+    case 1:
+        if (islice(e, w)) {
+            gcroot(f, ishade);
+            islice(-1, 0);
+            for (m = lold; m; m = (lval*)m[0]) {
+                if (!(m[1] & 1)) {
+                    m[2] &= ~4;
+                }
+            }
+            m = lold;
+            lold = 0;
+            lsweep(m);
+            memlive = ilast = ilive;
+            sweeps = 0;
+            sweepp = NULL;
+            gcphase = 2;
+        }
+        break;
+    case 2:
+        if (sslice(e, w)) {
+            gcphase = 0;
+            fprintf(stderr, ";incremental collection done. %lld free.\n", (long long)(heap_words - memlive));
+            if ((heap_words - memlive) * 4 < heap_words) {
+                mgrow(heap_words / 2);
+            }
         }
     }
+}
 
-    for (r = o2a(r)[2]; r; r = cdr(r)) {
-        T = o2a(caar(r))[4];
-        o2a(caar(r))[4] = cdar(r);
-        set_cdr(car(r), T);
-        U = cons(g, cons(g, caar(r), -8), U);
+/**
+ * Nursery collection, see above.
+ */
+void gcn(lval* f) {
+    int i;
+    lint e = gc_pause ? usec() + gc_pause : 0;
+    lint w = GC_WORK * nursery_used;
+    if (removf) {
+        gc(f);
+        return;
+    }
+    gcroot(f, gcm);
+    for (i = 0; i < remc; i++) {
+        gcm(*remset[i] & ~LVAL_GCM_BIT);
+    }
+    gclap();
+    if (gc_pause) {
+        gcstep(f, e, w);
     }
-    NE = U;
-    T = eval_body(g, cdr(ex));
-    unwind(g, cdr(dyns));
-    return T;
 }
 
-lval eval_letm(lval* f, lval ex) {
-    lval r;
-    NF(2) T = U = 0;
-    r = ma(g, 1, 84, LVAL_NIL);
-    dyns = cons(g, r, dyns);
-    for (T = car(ex); T; T = cdr(T)) {
-        U = evca(g, cdar(T));
-        if (o2a(caar(T))[8] & 128 || specp(g, cdr(ex), caar(T))) {
-            o2a(r)[2] = cons(g, cons(g, caar(T), o2a(caar(T))[4]), o2a(r)[2]);
-            o2a(caar(T))[4] = U;
-            U = -8;
-        } U = cons(g, caar(T), U);
-        NE = cons(g, U, NE);
+/**
+ * Slow path of m0: takes a filed hole, or moves the cursor to the next hole
+ * of n words or more, filing the ones passed. Returns NULL when a
+ * collection is due.
+ */
+lval* m1(lint n) {
+    lval* m = meml;
+    lval* h;
+    lint l;
+    lint c = n > nursery_size ? n : nursery_size;
+    if (nursery_used >= nursery_size) {
+        return NULL;
     }
-    T = eval_body(g, cdr(ex));
-    unwind(g, cdr(dyns));
-    return T;
+    if (n >= LARGE_MIN) {
+        return mlarge(n);
+    }
+    if ((h = hpop(n))) {
+        nursery_used += n;
+        return h;
+    }
+    hfile(memp, meml - memp);
+    memp = meml;
+    for (;;) {
+        lval* z = memw == segc ? memy : segs[mems].hi;
+        while (m < z && m[0] & 4) {
+            m += hsize(m);
+        }
+        for (h = m; m < z && !(m[0] & 4) && m - h < c; m += hsize(m));
+        l = m - h;
+        if (l >= n) {
+            break;
+        }
+        hfile(h, l);
+        if (m >= z) {
+            if (memw == segc) {
+                return NULL;
+            }
+            memw++;
+            mems = (mems + 1) % segc;
+            memh = meml = memp = m = segs[mems].lo;
+        }
+    }
+    memset(h, 0, l * sizeof(lval));
+    nursery_used += l;
+    memh = h;
+    memp = h + n;
+    meml = m;
+    return h;
 }
 
-lval eval_progv(lval* f, lval ex) {
-    lval r;
-    NF(2) T = U = 0;
-    r = ma(g, 1, 84, LVAL_NIL);
-    T = evca(g, ex);
-    U = evca(g, cdr(ex));
-    dyns = cons(g, r, dyns);
-    for (; T && U; T = cdr(T), U = cdr(U)) {
-        o2a(r)[2] = cons(g, cons(g, car(T), o2a(car(T))[4]), o2a(r)[2]);
-        o2a(car(T))[4] = car(U);
+/**
+ * Allocates n zeroed lval units in the context memory and returns it.
+ * Returns NULL if a collection is due.
+ * The caller party may use n lval blocks if the returned pointer is not null.
+ */
+lval* m0(lint n) {
+    lval* m = memp;
+    n = (n + 1) & ~1; /* round odd size to the greater even */
+    if (n <= meml - m) {
+        memp = m + n;
+        return m;
     }
-    T = eval_body(g, cddr(ex));
-    unwind(f, cdr(dyns));
-    return T;
+    return m1(n);
 }
 
-lval eval_flet(lval* f, lval ex) {
-    NF(4) V = W = 0;
-    U = E;
-    for (T = car(ex); T; T = cdr(T)) {
-        V = ma(g, 5, 212, ms(f, 3, 212, infn, LVAL_NIL, (lval)-1), E, cadr(car(T)), cddr(car(T)), caar(T));
-        W = cons(g, caar(T), 16);
-        V = cons(g, W, V);
-        U = cons(g, V, U);
-    }
-    NE = U;
-    return eval_body(g, cdr(ex));
+/**
+ * Compacting collection, by (gc :compact t), or when an allocation still
+ * fails after a full collection and the heap may not grow: the live
+ * objects slide down over the free blocks, in address order as in Lisp 2,
+ * and the heap ends with a single hole.
+ * </p>
+ * C code keeps objects in its variables while it allocates, so a block
+ * which a word of the C stack points into stays where it is, and so do
+ * the other blocks starting in its chunk of CHUNK_GRANULES granules (2
+ * words). The segments of the fasl units stay too, as their code
+ * addresses its constants, and so do the objects in the tables of the
+ * units, which their code keeps in C arrays. Large objects never move.
+ * </p>
+ * The new address of a block is the destination of its chunk plus the
+ * live words before it in the chunk, counted in the bitmap of the
+ * segment, whose bits are set for the granules of the live blocks.
+ * </p>
+ * Only valid right after a full collection. The objects whose hash
+ * depends on their address are hashed again, see moved.
+ */
+#define CHUNK_GRANULES  (64)
+#define CHUNK_NONE      (64)
+#define CHUNK_PIN       (65)
+
+struct chunk {
+    lval* to;
+    int first;
+} *chunks[SEG_MAX];
+
+char* cstack;
+lval* cands;
+lint candc;
+lint candn;
+
+int gbit(struct segment* s, lint i) {
+    return s->bits[i >> 3] >> (i & 7) & 1;
 }
 
-lval eval_labels(lval* f, lval ex) {
-    NF(4) V = W = 0;
-    U = E;
-    for (T = car(ex); T; T = cdr(T))
-        U = cons(g, 0, U);
-    NE = U;
-    for (T = car(ex); T; T = cdr(T), U = cdr(U)) {
-        V = ma(g, 5, 212, ms(f, 3, 212, infn, LVAL_NIL, (lval)-1), NE, cadr(car(T)), cddr(car(T)), caar(T));
-        W = cons(g, caar(T), 16);
-        set_car(U, cons(g, W, V));
+/**
+ * Notes the word v, which may point into a block that must not move.
+ */
+void cand(lval v) {
+    if (sfind((lval*)v)) {
+        if (candc == candn) {
+            cands = sgrow(cands, &candn);
+        }
+        cands[candc++] = v;
     }
-    return eval_body(g, cdr(ex));
 }
 
-lval eval_macrolet(lval* f, lval ex) {
-    NF(4) V = W = 0;
-    U = E;
-    for (T = car(ex); T; T = cdr(T)) {
-        V = ma(g, 5, 212, ms(f, 3, 212, infn, LVAL_NIL, (lval)-1), E, cadr(car(T)), cddr(car(T)), caar(T));
-        W = cons(g, caar(T), 24);
-        V = cons(g, W, V);
-        U = cons(g, V, U);
+#if defined(__GNUC__)
+__attribute__((noinline, no_sanitize_address))
+#endif
+void cscan() {
+    jmp_buf j;
+    lval* p;
+#if defined(__GNUC__)
+    /*
+     * glibc mangles rbp, rsp and pc in a jmp_buf, so have the prologue
+     * save every callee-saved register in this frame as it is
+     */
+    __builtin_unwind_init();
+#endif
+    setjmp(j);
+    for (p = (lval*)&j; p < (lval*)(&j + 1); p++) {
+        cand(*p);
+    }
+    for (p = (lval*)((lint)&p & ~(lint)(sizeof(lval) - 1)); p < (lval*)cstack; p++) {
+        cand(*p);
     }
-    NE = U;
-    return eval_body(g, cdr(ex));
 }
 
-lval eval_symbol_macrolet(lval* f, lval ex) {
-    NF(3) V = 0;
-    U = E;
-    for (T = car(ex); T; T = cdr(T)) {
-        V = cons(g, caar(T), 8);
-        V = cons(g, V, cadr(car(T)));
-        U = cons(g, V, U);
-    } NE = U;
-    return eval_body(g, cdr(ex));
+int ccmp(const void* a, const void* b) {
+    return *(lval*)a < *(lval*)b ? -1 : *(lval*)a > *(lval*)b;
 }
 
-lval eval_setq(lval* f, lval ex) {
-    lval r;
-    do {
-        r = evca(f, cdr(ex));
-        *binding(f, car(ex), 0, 0) = r;
-        ex = cddr(ex);
-    } while (ex);
-    return r;
+/**
+ * Returns the new address of the value v.
+ */
+lval cfwd(lval v) {
+    lval* t = (lval*)(v & ~3);
+    struct segment* s;
+    struct chunk* c;
+    lint i;
+    lint k;
+    lint n = 0;
+    if (!(v & 3) || !(s = sfind(t))) {
+        return v;
+    }
+    i = (t - s->lo) >> 1;
+    c = chunks[s - segs] + i / CHUNK_GRANULES;
+    if (c->first >= CHUNK_NONE || !gbit(s, i)) {
+        return v;
+    }
+    for (k = i - i % CHUNK_GRANULES + c->first; k < i; k++) {
+        n += gbit(s, k);
+    }
+    return (lval)(c->to + 2 * n) | (v & 3);
 }
 
-lval eval_function(lval* f, lval ex) {
-    lval x;
-    ex = car(ex);
-    if (cp(ex)) {
-        if (car(ex) == symi[75].sym) {
-            /* 75 - lambda */
-            lval n = 0;
-            x = cddr(ex);
-            if (!cdr(x) && caar(x) == symi[23].sym) {
-                x = car(x);
-                n = cadr(x);
-                x = cddr(x);
-            }
-            return ma(f, 5, 212, ms(f, 3, 212, infn, LVAL_NIL, (lval)-1), E, cadr(ex), x, n);
+/**
+ * Sets the slots of the objects reachable from v to the new addresses,
+ * clearing the mark bit of each object as it is done.
+ */
+void cfix(lval v) {
+    lval* t;
+    lint i;
+    mpush(v);
+    while (mstkc) {
+        v = mstk[--mstkc];
+        t = (lval*)(v & ~3);
+        if (!(t[0] & 4)) {
+            continue;
         }
-        else {
-            x = *binding(f, cadr(ex), 2, 0);
+        t[0] &= ~4;
+        if ((v & 3) == 1) {
+            mpush(t[0]);
+            mpush(t[1]);
+            t[0] = cfwd(t[0]);
+            t[1] = cfwd(t[1]);
+        }
+        else if ((v & 3) == 2) {
+            mpush(t[1] - 4);
+            t[1] = cfwd(t[1] - 4) + 4;
+            for (i = 0; i < t[0] >> 8; i++) {
+                mpush(t[i + 2]);
+                t[i + 2] = cfwd(t[i + 2]);
+            }
         }
     }
-    else {
-        x = *binding(f, ex, 1, 0);
-    }
-    if (x != 8) {
-        return x;
-    }
+}
 
-    dbgr(f, 1, ex, &x);
-    return x;
+void croot(lval* p) {
+    cfix(*p);
+    *p = cfwd(*p);
 }
 
-lval eval_tagbody(lval* f, lval ex) {
-    jmp_buf jmp;
-    lval tag;
-    lval e;
-    NF(2) T = U = 0;
-    U = ms(g, 1, 52, (lval)&jmp);
-    dyns = cons(g, U, dyns);
+void csyms();
 
-    for (e = ex; e; e = cdr(e)) {
-        if (ap(car(e))) {
-            T = cons(g, dyns, U);
-            NE = cons(g, cons(g, cons(g, car(e), 48), T), NE);
-        }
+/**
+ * Formats the free words from *q up to the block m of segment ms, moving
+ * *q and *qs there.
+ */
+void cgap(lval** q, int* qs, lval* m, int ms) {
+    for (; *qs < ms; ++*qs, *q = segs[*qs].lo) {
+        hfile(*q, segs[*qs].hi - *q);
     }
-    e = ex;
+    hfile(*q, m - *q);
+    *q = m;
+}
 
-again:
-    if (!(tag = setjmp(jmp))) {
-        for (; e; e = cdr(e)) {
-            if (!ap(car(e))) {
-                evca(g, e);
+void gccompact(lval* f) {
+    struct segment* s;
+    struct chunk* c;
+    lval* m;
+    lval* e;
+    lval* t;
+    lval* q;
+    lval* z = NULL;
+    lval l;
+    lint i;
+    lint n;
+    lint w;
+    lint ci = 0;
+    int ts = 0;
+    int qs = 0;
+    int pin;
+    fprintf(stderr, ";compacting...\n");
+    candc = 0;
+    cscan();
+    for (m = f; m > stack; m--) {
+        if (!(*m & 3)) {
+            cand(*m);
+        }
+    }
+    for (l = fasls; l; l = cdr(l)) {
+        for (i = 0; i < o2a(car(l))[0] >> 8; i++) {
+            cand(o2a(car(l))[2 + i]);
+        }
+    }
+    qsort(cands, candc, sizeof(lval), ccmp);
+    /* the live granules, and where each chunk goes */
+    t = segs[0].lo;
+    for (s = segs; s < segs + segc; s++) {
+        n = (s->hi - s->lo + 2 * CHUNK_GRANULES - 1) / (2 * CHUNK_GRANULES);
+        memset(s->bits, 0, (s->hi - s->lo) / 16 + 1);
+        if (!(chunks[s - segs] = malloc(n * sizeof(struct chunk)))) {
+            fprintf(stderr, "Out of memory");
+            exit(-1);
+        }
+        m = s->lo;
+        for (c = chunks[s - segs]; c < chunks[s - segs] + n; c++) {
+            e = s->lo + 2 * CHUNK_GRANULES * (c - chunks[s - segs] + 1);
+            e = e < s->hi ? e : s->hi;
+            c->first = CHUNK_NONE;
+            pin = s->pin;
+            w = 0;
+            for (; m < e; m += hsize(m)) {
+                if (!(m[0] & 4)) {
+                    continue;
+                }
+                for (i = (m - s->lo) >> 1; i < (m - s->lo + hsize(m)) >> 1; i++) {
+                    s->bits[i >> 3] |= 1 << (i & 7);
+                }
+                if (c->first == CHUNK_NONE) {
+                    c->first = (int)((m - s->lo) >> 1) % CHUNK_GRANULES;
+                }
+                w += hsize(m);
+                z = m + hsize(m);
+                for (; ci < candc && cands[ci] < (lval)m; ci++);
+                pin |= ci < candc && cands[ci] < (lval)(m + hsize(m));
             }
+            if (c->first == CHUNK_NONE) {
+                continue;
+            }
+            if (pin) {
+                c->first = CHUNK_PIN;
+                t = z;
+                ts = (int)(s - segs);
+                continue;
+            }
+            while (segs + ts < s && (segs[ts].pin || t + w > segs[ts].hi)) {
+                t = segs[++ts].lo;
+            }
+            c->to = t;
+            t += w;
         }
     }
-    else {
-        for (e = ex; e; e = cdr(e)) {
-            if (car(e) == tag) {
-                e = cdr(e);
-                goto again;
+    /* the pointers */
+    croot(&xvalues);
+    croot(&pkgs);
+    croot(&pkg);
+    croot(&kwp);
+    croot(&dyns);
+    croot(&fasls);
+    for (i = 0; i < gcrootc; i++) {
+        croot(gcroots + i);
+    }
+    for (m = f; m > stack; m--) {
+        croot(m);
+    }
+    csyms();
+    for (m = lold; m; m = (lval*)m[0]) {
+        m[2] |= 4;
+    }
+    /* the objects */
+    q = segs[0].lo;
+    for (s = segs; s < segs + segc; s++) {
+        c = chunks[s - segs];
+        for (m = s->lo; m < s->hi; m += n) {
+            n = hsize(m);
+            i = (m - s->lo) >> 1;
+            if (!gbit(s, i)) {
+                continue;
+            }
+            if (c[i / CHUNK_GRANULES].first == CHUNK_PIN) {
+                cgap(&q, &qs, m, (int)(s - segs));
+                q = m + n;
+            }
+            else {
+                if (i % CHUNK_GRANULES == c[i / CHUNK_GRANULES].first) {
+                    cgap(&q, &qs, c[i / CHUNK_GRANULES].to, (int)(sfind(c[i / CHUNK_GRANULES].to) - segs));
+                }
+                memmove(q, m, n * sizeof(lval));
+                q += n;
             }
+            q[-n] |= 4;
         }
+        free(c);
     }
-
-    unwind(g, cdr(dyns));
-    return 0;
+    mems = qs;
+    memh = meml = memp = q;
+    cgap(&q, &qs, segs[segc - 1].hi, segc - 1);
+    gclap();
+    moved++;
+    fprintf(stderr, ";done.\n");
 }
 
-lval eval_go(lval* f, lval ex) {
-    lval b = *binding(f, car(ex), 3, 0);
-    if (o2s(cdr(b))[2]) {
-        unwind(f, car(b));
-        longjmp(*(jmp_buf*)(o2s(cdr(b))[2]), car(ex));
+/**
+ * (gc &key compact)
+ */
+lval lgc(lval* f, lval* h) {
+    lval* a;
+    for (a = f + 1; a + 1 < h; a += 2) {
+        if (ap(*a) && o2a(*a)[1] == 20 && o2a(*a)[9] == kwp
+            && !strcmp(o2z(o2a(*a)[2]), "COMPACT") && a[1]) {
+            gc(h - 1);
+            gccompact(h - 1);
+            return 0;
+        }
     }
-    dbgr(f, 9, car(ex), &ex);
-    longjmp(top_jmp, 1);
+    return gc(h - 1);
 }
 
-lval eval_block(lval* f, lval ex) {
-    jmp_buf jmp;
-    lval vs;
-    NF(2) T = U = 0;
-    T = ms(g, 1, 52, (lval)&jmp);
-    U = cons(g, dyns, T);
-    dyns = cons(g, T, dyns);
-    NE = cons(g, cons(g, cons(g, car(ex), 64), U), NE);
-    if (!(vs = setjmp(jmp))) {
-        T = eval_body(g, cdr(ex));
-        unwind(g, cdr(dyns));
-        return T;
-    }
-    return mvalues(car(vs));
-}
+#define GC_MAX_RETRY    (3)
 
-lval eval_return_from(lval* f, lval ex) {
-    lval b;
-    jmp_buf* jmp;
-    NF(1) T = 0;
-    b = *binding(g, car(ex), 4, 0);
-    jmp = (jmp_buf*)o2s(cdr(b))[2];
-    if (jmp) {
-        unwind(g, car(b));
-        T = rvalues(g, evca(g, cdr(ex)));
-        longjmp(*jmp, cons(g, T, LVAL_NIL));
+/**
+ * Allocates n lval units, collecting garbage, growing the heap or
+ * compacting it if needed.
+ * Never returns NULL.
+ */
+lval* cm0(lval* g, lint n) {
+    lval* m = m0(n);
+    int i;
+    for (i = 0; !m && i < GC_MAX_RETRY; ++i) {
+        if (i == 0) {
+            gcn(g);
+        }
+        else if (i == 1) {
+            gc(g);
+        }
+        else if (n >= LARGE_MIN
+            || (!mgrow(n > heap_words / 2 ? n : heap_words / 2) && !mgrow(n))) {
+            break;
+        }
+        m = m0(n);
     }
-    dbgr(g, 8, car(ex), &T);
-    longjmp(top_jmp, 1);
-}
-
-lval eval_catch(lval* f, lval ex) {
-    jmp_buf jmp;
-    lval vs;
-    lval oc = dyns;
-    NF(2)
-        T = U = 0;
-    U = evca(g, ex);
-    T = ms(g, 1, 20, (lval)&jmp);
-    T = cons(g, U, T);
-    dyns = cons(g, T, dyns);
-    if (!(vs = setjmp(jmp))) {
-        vs = eval_body(g, cdr(ex));
+    if (!m && n < LARGE_MIN) {
+        gccompact(g);
+        m = m0(n);
     }
-    else {
-        vs = mvalues(car(vs));
+    /* Recheck pointer after gc */
+    if (!m) {
+        fprintf(stderr, "Out of memory");
+        exit(-1);
     }
-    dyns = oc;
-    return vs;
+    return m;
 }
 
-lval eval_throw(lval* f, lval ex) {
-    lval c;
-    NF(1) T = 0;
-    T = evca(g, ex);
-
-st:
-    for (c = dyns; c; c = cdr(c)) {
-        if (cp(car(c)) && caar(c) == T) {
-            unwind(g, c);
-            T = evca(g, cdr(ex));
-            T = rvalues(g, T);
-            longjmp(*(jmp_buf*)(o2s(cdar(c))[2]), cons(g, T, LVAL_NIL));
-        }
-    }
-    dbgr(g, 5, T, &T);
-    goto st;
+/**
+ * Allocates iref
+ */
+lval* ma0(lval* g, lint n) {
+    lval* m = cm0(g, n + 2LL);
+    *m = n << LVAL_IREF_SIZE_BIT_SHIFT;
+    return m;
 }
 
-lval eval_unwind_protect(lval* f, lval ex) {
-    NF(1) T = 0;
-    T = ma(g, 2, 52, E, cdr(ex));
-    dyns = cons(g, T, dyns);
-    T = evca(g, ex);
-    T = rvalues(g, T);
-    unwind(g, cdr(dyns));
-    return mvalues(T);
+/**
+ * Allocates jref
+ */
+lval* ms0(lval* g, lint n) {
+    lval* m = cm0(g, (n+12LL)/4LL);
+    *m = (n + 4) << LVAL_JREF_SIZE_BIT_SHIFT;
+    return m;
 }
 
-lval eval_if(lval* f, lval ex) {
-    return evca(f, evca(f, ex) ? cdr(ex) : cddr(ex));
+lval* mb0(lval* g, lint n) {
+    lval* m = cm0(g, (n + 95LL) / 32LL);
+    *m = (n + 31) << 3;
+    return m;
 }
 
-lval eval_multiple_value_call(lval* f, lval ex) {
-    lval* g = f + 3;
-    lval l;
-    f[1] = evca(f, ex);
-    for (ex = cdr(ex); ex; ex = cdr(ex)) {
-        *g = *f;
-        g[-1] = ((g - f - 3) << 5) | 16;
-        for (l = rvalues(g, evca(g, ex)); l; l = cdr(l)) {
-            g[-1] = car(l);
-            g++;
+X lval ma(lval* g, lint n, ...) {
+    va_list v;
+    int i;
+    lval* m = m0(n + 2LL);
+    if (!m) {
+        /* the initial contents have to survive the collection */
+        va_start(v, n);
+        for (i = -1; i < n && gcrootc < GC_ROOTS; i++) {
+            gcroots[gcrootc++] = va_arg(v, lval);
         }
-    } xvalues = 8;
-    return call(f, f[1], g - f - 3);
-}
-
-lval eval_multiple_value_prog1(lval* f, lval ex) {
-    NF(1) T = 0;
-    T = evca(g, ex);
-    T = rvalues(g, T);
-    eval_body(g, cdr(ex));
-    return mvalues(T);
-}
-
-lval eval_declare(lval* f, lval ex) {
-    return LVAL_NIL;
-}
-
-lval l2(lval* f, lval a, lval b) {
-    return cons(f, a, cons(f, b, LVAL_NIL));
-}
-
-lval eval_setf(lval* f, lval ex) {
-    lval r;
-    int m;
-    NF(1) T = LVAL_NIL;
-
-ag:
-    if (!cp(car(ex))) {
-        r = *binding(g, car(ex), 0, &m);
-        if (!m)
-            return *binding(g, car(ex), 0, 0)
-            = evca(g, cdr(ex));
-        set_car(ex, r);
-        goto ag;
+        va_end(v);
+        m = cm0(g, n + 2LL);
+        gcrootc -= i + 1;
     }
-    r = *binding(g, caar(ex), 2, 0);
-
-    if (r == 8) {
-        dbgr(g, 1, l2(f, symi[33].sym, caar(ex)), &r);
+    *m = n << 8;
+    va_start(v, n);
+    for (i = -1; i < n; i++) {
+        m[2 + i] = va_arg(v, lval);
     }
-
-    T = cons(g, cadr(ex), cdar(ex));
-    return call(g, r, map_eval(g, T));
+    va_end(v);
+    return a2o(m);
 }
 
-lval llist(lval* f, lval* h) {
-    return rest(h, f + 1);
+X lval ms(lval* g, lint n, ...) {
+    va_list v;
+    int i;
+    lval* m = cm0(g, n + 2LL);
+    *m = n << 8;
+    va_start(v, n);
+    for (i = -1; i < n; i++) {
+        m[2 + i] = va_arg(v, lval);
+    }
+    va_end(v);
+    return s2o(m);
 }
 
-lval lvalues(lval* f, lval* h) {
-    return mvalues(rest(h, f + 1));
-}
+double b2d(lval);
+uintptr_t bword(lval);
+int bigp(lval);
 
-lval lfuncall(lval* f, lval* h) {
-    return call(f, f[1], h - f - 2);
+double o2d(lval o) {
+    return sp(o) ? o2s(o)[1] == LVAL_JREF_BIGNUM_SUBTYPE ? b2d(o)
+        : *(double*)(o2s(o) + 2) : o >> 5;
 }
 
-lval lapply(lval* f, lval* h) {
-    while (h[-1]) {
-        h[0] = cdr(h[-1]);
-        h[-1] = car(h[-1]);
-        h++;
+lval d2o(lval* g, double d) {
+    lval x = (lval)d << 5 | 16;
+    lval* a;
+    if (o2d(x) == d) {
+        return x;
     }
-    return call(f, f[1], h - f - 3);
-}
 
-lval leq(lval* f) {
-    return f[1] == f[2] ? TRUE : 0;
+    a = ms0(g, 2);
+    a[1] = 84;
+    *(double*)(a + 2) = d;
+    return s2o(a);
 }
 
-lval lcons(lval* f) {
-    return cons(f, f[1], f[2]);
+lint o2i(lval o) {
+    return sp(o) ? (lint)o2d(o) : o >> 5;
 }
 
-lval lcar(lval* f) {
-    return car(f[1]);
+uintptr_t o2u(lval o) {
+    return (o & 31) == 16 ? (uintptr_t)(o >> 5) : bigp(o) ? bword(o) : (uintptr_t)o2d(o);
 }
 
-lval setfcar(lval* f) {
-    return set_car(f[2], f[1]);
+/**
+ * Creates cons cell of a and b.
+ * Stack pointer f is used for garbage collecting.
+ */
+lval cons(lval* g, lval a, lval d) {
+    lval* c = m0(2);
+    int r = gcrootc;
+    if (!c) {
+        if (gcrootc + 2 <= GC_ROOTS) {
+            gcroots[gcrootc++] = a;
+            gcroots[gcrootc++] = d;
+        }
+        c = cm0(g, 2);
+        gcrootc = r;
+    }
+    c[0] = a;
+    c[1] = d;
+    return c2o(c);
 }
 
-lval lcdr(lval* f) {
-    return cdr(f[1]);
+int string_equal_do(lval a, lval b) {
+    return !memcmp(o2z(a), o2z(b), o2s(a)[0] / 64 - 4);
 }
 
-lval setfcdr(lval* f) {
-    return set_cdr(f[2], f[1]);
+int string_equal(lval a, lval b) {
+    return a == b || (sp(a) && sp(b) &&
+        o2s(a)[1] == 20 && o2s(b)[1] == 20
+        && !((o2s(a)[0] ^ o2s(b)[0]) & ~LVAL_GCM_BIT)
+        && string_equal_do(a, b));
 }
 
-lval lequ(lval* f, lval* h) {
-    double s = o2d(f[1]); /* TODO: optimize */
-    for (f += 2; f < h; f++)
-        if (s != o2d(*f))
-            return 0;
-    return TRUE;
+lval argi(lval a, lval* b) {
+    if (cp(a)) {
+        *b = cdr(a);
+        return car(a);
+    }
+    *b = 0;
+    return a;
 }
 
-lval lless(lval* f, lval* h) {
-    double s = o2d(f[1]); /* TODO: optimize */
-    for (f += 2; f < h; f++)
-        if (s < o2d(*f))
-            s = o2d(*f);
-        else
-            return 0;
-    return TRUE;
+lval rest(lval* h, lval* g) {
+    lval* f = h - 1;
+    lval r = 0;
+    for (; f >= g; f--) {
+        r = cons(h, *f, r);
+    }
+    return r;
 }
 
-lval lplus(lval* f, lval* h) {
-    double s = 0; /* TODO: optimize */
-    for (f++; f < h; f++)
-        s += o2d(*f);
-    return d2o(f, s);
-}
+lval args(lval*, lval, lint);
 
-lval lminus(lval* f, lval* h) {
-    double s = o2d(f[1]); /* TODO: optimize */
-    f += 2;
-    if (f < h)
-        for (; f < h; f++)
-            s -= o2d(*f);
-    else
-        s = -s;
-    return d2o(f, s);
+lval argd(lval* f, lval n, lval a) {
+    if (cp(n)) {
+        lval* h = f;
+        for (; a; a = cdr(a)) {
+            *++h = car(a);
+        }
+        ++h;
+        *++h = *f;
+        return args(f, n, h - f - 2);
+    }
+    return cons(f, cons(f, n, a), *f);
 }
 
-lval ltimes(lval* f, lval* h) {
-    double s = 1; /* TODO: optimize */
-    for (f++; f < h; f++)
-        s *= o2d(*f);
-    return d2o(f, s);
-}
+lval args(lval* f, lval m, lint c) {
+    lval* g = f + 1;
+    lval* h = f + c + 2;
+    int t;
+    lval k, * l;
 
-lval ldivi(lval* f, lval* h) {
-    double s = o2d(f[1]); /* TODO: optimize */
-    f += 2;
-    if (f < h)
-        for (; f < h; f++)
-            s /= o2d(*f);
-    else
-        s = 1 / s;
-    return d2o(f, s);
-}
+st:
+    t = 0;
+    while (cp(m)) {
+        lval n = car(m);
+        m = cdr(m);
+        switch (cp(n) ? -1 : o2a(n)[7] >> 3) {
+        case 2:
+        case 3:
+            t = 1;
+            continue;
+        case 4:
+            t = 2;
+            continue;
+        case 5:
+            t = -2;
+            continue;
+        case 6:
+            t = 4;
+            continue;
+        case 7:
+            t = 5;
+            continue;
+        default:
+            switch (t) {
+            case 0:
+                if (g >= h - 1) {
+                    dbgr(g, 7, 0, h);
+                    goto st;
+                } *h = argd(h, n, *g);
+                break;
+            case 1:
+                *h = cons(h, cons(h, n, rest(h - 1, g)), *h);
+                t = -1;
+                continue;
+            case 2:
+                n = argi(n, &k);
+                *h = argd(h, n, g < h - 1 ? *g : evca(h, k));
+                break;
+            case -2:
+                n = argi(n, &k);
+                for (l = g; l < h - 1; l += 2) {
+                    if (string_equal(o2a(n)[2], o2a(*l)[2]) && o2a(*l)[9] == kwp) {
+                        k = l[1];
+                        break;
+                    }
+                }
+                *h = argd(h, n, l < h - 1 ? k : evca(h, k));
+                continue;
+            case 4:
+                *h = cons(h, cons(h, n, rest(h - 1, f + 1)), *h);
+                t = 0;
+                continue;
+            case 5:
+                *h = cons(h, cons(h, n, f[-1]), *h);
+                t = 0;
+                continue;
+            }
+        }
+        g++;
+    }
+    if (m) {
+        return cons(h, cons(h, m, rest(h - 1, g)), *h);
+    }
+
+    if (g < h - 1 && t >= 0) {
+        h[-1] = (c << 5) | 16;
+        dbgr(h, 6, 0, h);
+        goto st;
+    }
+
+    return *h;
+}
+
+lval eval_body(lval* f, lval ex) {
+    NF(1) T = 0;
+    for (; ex; ex = cdr(ex)) {
+        T = evca(g, ex);
+    }
+    return T;
+}
+
+lint map_eval(lval* f, lval ex) {
+    lval* g = (lval*) f + 3;
+    f[1] = 0;
+    for (; ex; ex = cdr(ex), g++) {
+        g[-1] = ((g - f - 3) << 5) | 16;
+        *g = *f;
+        g[-1] = evca(g, ex);
+    }
+    return g - f - 3;
+}
+
+lval eval(lval* f, lval expr) {
+    NF(1) T = 0;
+    T = cons(g, expr, 0);
+    return evca(g, T);
+}
+
+lval rvalues(lval* g, lval v) {
+    return xvalues == 8 ? cons(g, v, 0) : xvalues;
+}
+
+lval mvalues(lval a) {
+    xvalues = a;
+    return car(a);
+}
+
+lval infn(lval* f, lval* h) {
+    jmp_buf jmp;
+    lval vs;
+    lval* g = h + 1;
+    lval fn = *f;
+    lint d = h - f - 1;
+    h[1] = o2a(fn)[3];
+    NE = args(f, o2a(fn)[4], d);
+    g[-1] = cons(g, dyns, ms(g, 1, 20, (lval)&jmp));
+    NE = cons(g, cons(g, cons(g, o2a(fn)[6], 64), g[-1]), NE);
+    g[-1] = (d << 5) | 16;
+    if (!(vs = SJMP(jmp))) {
+        return eval_body(g, o2a(fn)[5]);
+    }
+    return mvalues(car(vs));
+}
+
+X lval call(lval* f, lval fn, uintptr_t d) {
+    lval* g = f + d + 3;
+    xvalues = 8;
+    if (o2a(fn)[1] == 20) {
+        fn = o2a(fn)[5];
+    }
+
+    if (o2a(fn)[0] & 16) {
+        fn = o2a(fn)[3];
+    }
+    *++f = fn;
+    fn = o2a(fn)[2];
+    if (d < (uintptr_t)o2s(fn)[3]) {
+        dbgr(g, 7, 0, f);
+    }
+    if (d > (uintptr_t) o2s(fn)[4]) {
+        dbgr(g, 6, 0, f);
+    }
+    return ((lval(*) ()) o2s(fn)[2]) (f, f + d + 1);
+}
+
+lval eval_quote(lval* g, lval ex) {
+    return car(ex);
+}
+
+/* TODO: f seems redundant here */
+int specp(lval* f, lval ex, lval s) {
+    for (; ex; ex = cdr(ex)) {
+        if (ap(caar(ex)) && o2a(caar(ex))[1] == 20 && o2a(caar(ex))[7] == 3 << 3) {
+            lval e = cdar(ex);
+            for (; e; e = cdr(e)) {
+                if (o2a(caar(e))[7] == 4 << 3) {
+                    lval sp = cdar(e);
+                    for (; sp; sp = cdr(sp)) {
+                        if (car(sp) == s) {
+                            return 1;
+                        }
+                    }
+                }
+            }
+        }
+        else {
+            break;
+        }
+    }
+    return 0;
+}
+
+void unwind(lval* f, lval c) {
+    lval e;
+    NF(0) for (; dyns != c; dyns = cdr(dyns))
+        if (ap(car(dyns))) {
+            if (o2a(car(dyns))[1] == 52) {
+                NE = o2a(car(dyns))[2];
+                eval_body(g, o2a(car(dyns))[3]);
+            }
+            else {
+                for (e = o2a(car(dyns))[2]; e; e = cdr(e)) {
+                    wb(o2a(caar(e)) + 4, o2a(caar(e))[4] = cdar(e));
+                }
+            }
+        }
+        else {
+            o2s(car(dyns))[2] = 0;
+        }
+}
+
+lval eval_let(lval* f, lval ex) {
+    lval r;
+    NF(3) T = car(ex);
+    U = E;
+    V = 0;
+    r = ma(g, 1, 84, LVAL_NIL);
+    dyns = cons(g, r, dyns);
+    for (; T; T = cdr(T)) {
+        V = evca(g, cdar(T));
+        if (o2a(caar(T))[8] & 128 || specp(g, cdr(ex), caar(T))) {
+            o2a(r)[2] = cons(g, cons(g, caar(T), V), o2a(r)[2]);
+            wb(o2a(r) + 2, o2a(r)[2]);
+        }
+        else {
+            U = cons(g, cons(g, caar(T), V), U);
+        }
+    }
+
+    for (r = o2a(r)[2]; r; r = cdr(r)) {
+        T = o2a(caar(r))[4];
+        wb(o2a(caar(r)) + 4, o2a(caar(r))[4] = cdar(r));
+        set_cdr(car(r), T);
+        U = cons(g, cons(g, caar(r), -8), U);
+    }
+    NE = U;
+    T = eval_body(g, cdr(ex));
+    unwind(g, cdr(dyns));
+    return T;
+}
+
+lval eval_letm(lval* f, lval ex) {
+    lval r;
+    NF(2) T = U = 0;
+    r = ma(g, 1, 84, LVAL_NIL);
+    dyns = cons(g, r, dyns);
+    for (T = car(ex); T; T = cdr(T)) {
+        U = evca(g, cdar(T));
+        if (o2a(caar(T))[8] & 128 || specp(g, cdr(ex), caar(T))) {
+            o2a(r)[2] = cons(g, cons(g, caar(T), o2a(caar(T))[4]), o2a(r)[2]);
+            wb(o2a(r) + 2, o2a(r)[2]);
+            wb(o2a(caar(T)) + 4, o2a(caar(T))[4] = U);
+            U = -8;
+        } U = cons(g, caar(T), U);
+        NE = cons(g, U, NE);
+    }
+    T = eval_body(g, cdr(ex));
+    unwind(g, cdr(dyns));
+    return T;
+}
+
+lval eval_progv(lval* f, lval ex) {
+    lval r;
+    NF(2) T = U = 0;
+    r = ma(g, 1, 84, LVAL_NIL);
+    T = evca(g, ex);
+    U = evca(g, cdr(ex));
+    dyns = cons(g, r, dyns);
+    for (; T && U; T = cdr(T), U = cdr(U)) {
+        o2a(r)[2] = cons(g, cons(g, car(T), o2a(car(T))[4]), o2a(r)[2]);
+        wb(o2a(r) + 2, o2a(r)[2]);
+        wb(o2a(car(T)) + 4, o2a(car(T))[4] = car(U));
+    }
+    T = eval_body(g, cddr(ex));
+    unwind(f, cdr(dyns));
+    return T;
+}
+
+lval eval_flet(lval* f, lval ex) {
+    NF(4) V = W = 0;
+    U = E;
+    for (T = car(ex); T; T = cdr(T)) {
+        V = ma(g, 5, 212, ms(g, 3, 212, infn, LVAL_NIL, (lval)-1), E, cadr(car(T)), cddr(car(T)), caar(T));
+        W = cons(g, caar(T), 16);
+        V = cons(g, W, V);
+        U = cons(g, V, U);
+    }
+    NE = U;
+    return eval_body(g, cdr(ex));
+}
+
+lval eval_labels(lval* f, lval ex) {
+    NF(4) V = W = 0;
+    U = E;
+    for (T = car(ex); T; T = cdr(T))
+        U = cons(g, 0, U);
+    NE = U;
+    for (T = car(ex); T; T = cdr(T), U = cdr(U)) {
+        V = ma(g, 5, 212, ms(g, 3, 212, infn, LVAL_NIL, (lval)-1), NE, cadr(car(T)), cddr(car(T)), caar(T));
+        W = cons(g, caar(T), 16);
+        set_car(U, cons(g, W, V));
+    }
+    return eval_body(g, cdr(ex));
+}
+
+lval eval_macrolet(lval* f, lval ex) {
+    NF(4) V = W = 0;
+    U = E;
+    for (T = car(ex); T; T = cdr(T)) {
+        V = ma(g, 5, 212, ms(g, 3, 212, infn, LVAL_NIL, (lval)-1), E, cadr(car(T)), cddr(car(T)), caar(T));
+        W = cons(g, caar(T), 24);
+        V = cons(g, W, V);
+        U = cons(g, V, U);
+    }
+    NE = U;
+    return eval_body(g, cdr(ex));
+}
+
+lval eval_symbol_macrolet(lval* f, lval ex) {
+    NF(3) V = 0;
+    U = E;
+    for (T = car(ex); T; T = cdr(T)) {
+        V = cons(g, caar(T), 8);
+        V = cons(g, V, cadr(car(T)));
+        U = cons(g, V, U);
+    } NE = U;
+    return eval_body(g, cdr(ex));
+}
+
+lval eval_setq(lval* f, lval ex) {
+    lval r;
+    lval* p;
+    do {
+        r = evca(f, cdr(ex));
+        p = binding(f, car(ex), 0, 0);
+        wb(p, *p = r);
+        ex = cddr(ex);
+    } while (ex);
+    return r;
+}
+
+lval eval_function(lval* f, lval ex) {
+    lval x;
+    ex = car(ex);
+    if (cp(ex)) {
+        if (car(ex) == symi[75].sym) {
+            /* 75 - lambda */
+            lval n = 0;
+            x = cddr(ex);
+            if (!cdr(x) && caar(x) == symi[23].sym) {
+                x = car(x);
+                n = cadr(x);
+                x = cddr(x);
+            }
+            return ma(f, 5, 212, ms(f, 3, 212, infn, LVAL_NIL, (lval)-1), E, cadr(ex), x, n);
+        }
+        else {
+            x = *binding(f, cadr(ex), 2, 0);
+        }
+    }
+    else {
+        x = *binding(f, ex, 1, 0);
+    }
+    if (x != 8) {
+        return x;
+    }
+
+    dbgr(f, 1, ex, &x);
+    return x;
+}
+
+lval eval_tagbody(lval* f, lval ex) {
+    jmp_buf jmp;
+    lval tag;
+    lval e;
+    NF(2) T = U = 0;
+    U = ms(g, 1, 52, (lval)&jmp);
+    dyns = cons(g, U, dyns);
+
+    for (e = ex; e; e = cdr(e)) {
+        if (ap(car(e)) && !nodep(car(e))) {
+            T = cons(g, dyns, U);
+            NE = cons(g, cons(g, cons(g, car(e), 48), T), NE);
+        }
+    }
+    e = ex;
+
+again:
+    if (!(tag = SJMP(jmp))) {
+        for (; e; e = cdr(e)) {
+            if (!ap(car(e)) || nodep(car(e))) {
+                evca(g, e);
+            }
+        }
+    }
+    else {
+        for (e = ex; e; e = cdr(e)) {
+            if (car(e) == tag) {
+                e = cdr(e);
+                goto again;
+            }
+        }
+    }
+
+    unwind(g, cdr(dyns));
+    return 0;
+}
+
+lval eval_go(lval* f, lval ex) {
+    lval b = *binding(f, car(ex), 3, 0);
+    if (o2s(cdr(b))[2]) {
+        unwind(f, car(b));
+        LJMP(*(jmp_buf*)(o2s(cdr(b))[2]), car(ex));
+    }
+    dbgr(f, 9, car(ex), &ex);
+    longjmp(top_jmp, 1);
+}
+
+lval eval_block(lval* f, lval ex) {
+    jmp_buf jmp;
+    lval vs;
+    NF(2) T = U = 0;
+    T = ms(g, 1, 52, (lval)&jmp);
+    U = cons(g, dyns, T);
+    dyns = cons(g, T, dyns);
+    NE = cons(g, cons(g, cons(g, car(ex), 64), U), NE);
+    if (!(vs = SJMP(jmp))) {
+        T = eval_body(g, cdr(ex));
+        unwind(g, cdr(dyns));
+        return T;
+    }
+    return mvalues(car(vs));
+}
+
+lval eval_return_from(lval* f, lval ex) {
+    lval b;
+    jmp_buf* jmp;
+    NF(1) T = 0;
+    b = *binding(g, car(ex), 4, 0);
+    jmp = (jmp_buf*)o2s(cdr(b))[2];
+    if (jmp) {
+        unwind(g, car(b));
+        T = rvalues(g, evca(g, cdr(ex)));
+        LJMP(*jmp, cons(g, T, LVAL_NIL));
+    }
+    dbgr(g, 8, car(ex), &T);
+    longjmp(top_jmp, 1);
+}
+
+lval eval_catch(lval* f, lval ex) {
+    jmp_buf jmp;
+    lval vs;
+    lval oc = dyns;
+    NF(2)
+        T = U = 0;
+    U = evca(g, ex);
+    T = ms(g, 1, 20, (lval)&jmp);
+    T = cons(g, U, T);
+    dyns = cons(g, T, dyns);
+    if (!(vs = SJMP(jmp))) {
+        vs = eval_body(g, cdr(ex));
+    }
+    else {
+        vs = mvalues(car(vs));
+    }
+    dyns = oc;
+    return vs;
+}
+
+lval eval_throw(lval* f, lval ex) {
+    lval c;
+    NF(1) T = 0;
+    T = evca(g, ex);
+
+st:
+    for (c = dyns; c; c = cdr(c)) {
+        if (cp(car(c)) && caar(c) == T) {
+            unwind(g, c);
+            T = evca(g, cdr(ex));
+            T = rvalues(g, T);
+            LJMP(*(jmp_buf*)(o2s(cdar(c))[2]), cons(g, T, LVAL_NIL));
+        }
+    }
+    dbgr(g, 5, T, &T);
+    goto st;
+}
+
+lval eval_unwind_protect(lval* f, lval ex) {
+    NF(1) T = 0;
+    T = ma(g, 2, 52, E, cdr(ex));
+    dyns = cons(g, T, dyns);
+    T = evca(g, ex);
+    T = rvalues(g, T);
+    unwind(g, cdr(dyns));
+    return mvalues(T);
+}
+
+lval eval_if(lval* f, lval ex) {
+    return evca(f, evca(f, ex) ? cdr(ex) : cddr(ex));
+}
+
+lval eval_multiple_value_call(lval* f, lval ex) {
+    lval* g = f + 3;
+    lval l;
+    f[1] = evca(f, ex);
+    for (ex = cdr(ex); ex; ex = cdr(ex)) {
+        *g = *f;
+        g[-1] = ((g - f - 3) << 5) | 16;
+        for (l = rvalues(g, evca(g, ex)); l; l = cdr(l)) {
+            g[-1] = car(l);
+            g++;
+        }
+    } xvalues = 8;
+    return call(f, f[1], g - f - 3);
+}
+
+lval eval_multiple_value_prog1(lval* f, lval ex) {
+    NF(1) T = 0;
+    T = evca(g, ex);
+    T = rvalues(g, T);
+    eval_body(g, cdr(ex));
+    return mvalues(T);
+}
+
+lval eval_declare(lval* f, lval ex) {
+    return LVAL_NIL;
+}
+
+lval l2(lval* f, lval a, lval b) {
+    return cons(f, a, cons(f, b, LVAL_NIL));
+}
+
+lval eval_setf(lval* f, lval ex) {
+    lval r;
+    lval* p;
+    int m;
+    NF(1) T = LVAL_NIL;
+
+ag:
+    if (!cp(car(ex))) {
+        r = *binding(g, car(ex), 0, &m);
+        if (!m) {
+            T = evca(g, cdr(ex));
+            p = binding(g, car(ex), 0, 0);
+            wb(p, *p = T);
+            return T;
+        }
+        set_car(ex, r);
+        goto ag;
+    }
+    r = *binding(g, caar(ex), 2, 0);
+
+    if (r == 8) {
+        dbgr(g, 1, l2(g, symi[33].sym, caar(ex)), &r);
+    }
+
+    T = cons(g, cadr(ex), cdar(ex));
+    m = map_eval(g, T);
+    /* keep the compiled value form */
+    set_car(cdr(ex), car(T));
+    return call(g, r, m);
+}
+
+lval llist(lval* f, lval* h) {
+    return rest(h, f + 1);
+}
+
+lval lvalues(lval* f, lval* h) {
+    return mvalues(rest(h, f + 1));
+}
+
+lval lfuncall(lval* f, lval* h) {
+    return call(f, f[1], h - f - 2);
+}
+
+lval lapply(lval* f, lval* h) {
+    while (h[-1]) {
+        h[0] = cdr(h[-1]);
+        h[-1] = car(h[-1]);
+        h++;
+    }
+    return call(f, f[1], h - f - 3);
+}
+
+lval leq(lval* f) {
+    return f[1] == f[2] ? TRUE : 0;
+}
+
+lval lcons(lval* f) {
+    return cons(f, f[1], f[2]);
+}
+
+lval lcar(lval* f) {
+    return car(f[1]);
+}
+
+lval setfcar(lval* f) {
+    return set_car(f[2], f[1]);
+}
+
+lval lcdr(lval* f) {
+    return cdr(f[1]);
+}
+
+lval setfcdr(lval* f) {
+    return set_cdr(f[2], f[1]);
+}
+
+/**
+ * Integers.
+ * </p>
+ * A fixnum n is the word n << 5 | 16, so fixnums compare like their words,
+ * and adding or subtracting n << 5 to a fixnum gives the fixnum result.
+ * The word operations detect the overflow of the fixnum range.
+ * </p>
+ * Integers out of that range are bignums, jrefs of their own subtype: [2]
+ * is the number of 32 bit limbs, negated for a negative number, and the
+ * limbs of the magnitude follow, least significant first, without leading
+ * zeros. An integer that fits a fixnum is always one. Products of at least
+ * KARATSUBA_MIN limbs each are split recursively.
+ */
+#define FIXP(x) (((x) & 31) == 16)
+
+int addo(lint a, lint b, lint* r) {
+#ifdef __GNUC__
+    return __builtin_add_overflow(a, b, r);
+#else
+    if (b > 0 ? a > INTPTR_MAX - b : a < INTPTR_MIN - b) {
+        return 1;
+    }
+    *r = a + b;
+    return 0;
+#endif
+}
+
+int subo(lint a, lint b, lint* r) {
+#ifdef __GNUC__
+    return __builtin_sub_overflow(a, b, r);
+#else
+    if (b < 0 ? a > INTPTR_MAX + b : a < INTPTR_MIN + b) {
+        return 1;
+    }
+    *r = a - b;
+    return 0;
+#endif
+}
+
+int mulo(lint a, lint b, lint* r) {
+#ifdef __GNUC__
+    return __builtin_mul_overflow(a, b, r);
+#else
+    if (a && (a == -1 ? b == INTPTR_MIN : b == -1 ? a == INTPTR_MIN
+        : (a > 0) == (b > 0) ? b > INTPTR_MAX / a : b < INTPTR_MIN / a)) {
+        return 1;
+    }
+    *r = a * b;
+    return 0;
+#endif
+}
+
+#define KARATSUBA_MIN   (32)
+
+typedef uint32_t limb;
+
+/**
+ * The magnitude and sign of an integer. Fixnums use the buffer.
+ */
+struct bview {
+    lint n;
+    int s;
+    limb* d;
+    limb b[sizeof(lint) / sizeof(limb) + 1];
+};
+
+int bigp(lval x) {
+    return sp(x) && o2s(x)[1] == LVAL_JREF_BIGNUM_SUBTYPE;
+}
+
+int intp(lval x) {
+    return FIXP(x) || bigp(x);
+}
+
+void bview(lval x, struct bview* v) {
+    uintptr_t m;
+    if (bigp(x)) {
+        v->n = o2s(x)[2];
+        v->s = v->n < 0;
+        v->n = v->s ? -v->n : v->n;
+        v->d = (limb*)(o2s(x) + 3);
+        return;
+    }
+    v->s = x < 0;
+    m = v->s ? -(uintptr_t)(x >> 5) : (uintptr_t)(x >> 5);
+    v->d = v->b;
+    for (v->n = 0; m; m = m >> 16 >> 16) {
+        v->b[v->n++] = (limb)m;
+    }
+}
+
+lint blen(lval x) {
+    struct bview v;
+    bview(x, &v);
+    return v.n;
+}
+
+/**
+ * Allocates a bignum of n limbs.
+ */
+lval* bnew(lval* g, lint n) {
+    lval* m = ms0(g, sizeof(lval) + n * sizeof(limb));
+    m[1] = LVAL_JREF_BIGNUM_SUBTYPE;
+    m[2] = n;
+    return m;
+}
+
+/**
+ * Trims the magnitude of the bignum m, which has sign s, and turns it into
+ * a fixnum if it fits.
+ */
+lval bnorm(lval* m, int s) {
+    limb* d = (limb*)(m + 3);
+    lint n = m[2];
+    uintptr_t v = 0;
+    lint i;
+    for (; n && !d[n - 1]; n--);
+    if (n * 32 <= (lint)sizeof(uintptr_t) * 8) {
+        for (i = n; i--;) {
+            v = v << 16 << 16 | d[i];
+        }
+        if (v <= (uintptr_t)(INTPTR_MAX >> 5) + s) {
+            return (s ? -(lint)v : (lint)v) * 32 + 16;
+        }
+    }
+    m[2] = s ? -n : n;
+    return s2o(m);
+}
+
+lval bmake(lval* g, limb* d, lint n, int s) {
+    lval* m = bnew(g, n);
+    memcpy(m + 3, d, n * sizeof(limb));
+    return bnorm(m, s);
+}
+
+/**
+ * The integer of the machine word w, and the low word of an integer.
+ */
+lval w2o(lval* g, lint w) {
+    uintptr_t m = w < 0 ? -(uintptr_t)w : (uintptr_t)w;
+    limb d[2];
+    if (w >= -(INTPTR_MAX >> 5) - 1 && w <= INTPTR_MAX >> 5) {
+        return w * 32 + 16;
+    }
+    d[0] = (limb)m;
+    d[1] = (limb)(m >> 16 >> 16);
+    return bmake(g, d, 2, w < 0);
+}
+
+uintptr_t bword(lval x) {
+    struct bview v;
+    uintptr_t m;
+    bview(x, &v);
+    m = v.n ? v.d[0] : 0;
+    m |= v.n > 1 && sizeof(m) > sizeof(limb) ? (uintptr_t)v.d[1] << 16 << 16 : 0;
+    return v.s ? -m : m;
+}
+
+int mcmp(limb* a, lint an, limb* b, lint bn) {
+    for (; an && !a[an - 1]; an--);
+    for (; bn && !b[bn - 1]; bn--);
+    if (an != bn) {
+        return an < bn ? -1 : 1;
+    }
+    while (an--) {
+        if (a[an] != b[an]) {
+            return a[an] < b[an] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Adds a to the rn limbs at r.
+ */
+void madd(limb* r, lint rn, limb* a, lint an) {
+    uint64_t c = 0;
+    lint i;
+    for (i = 0; i < rn && (i < an || c); i++) {
+        c += (uint64_t)r[i] + (i < an ? a[i] : 0);
+        r[i] = (limb)c;
+        c >>= 32;
+    }
+}
+
+/**
+ * Subtracts a from the rn limbs at r, which must not get negative.
+ */
+void msub(limb* r, lint rn, limb* a, lint an) {
+    int64_t c = 0;
+    lint i;
+    for (i = 0; i < rn && (i < an || c); i++) {
+        c += (int64_t)r[i] - (i < an ? a[i] : 0);
+        r[i] = (limb)c;
+        c = c < 0 ? -1 : 0;
+    }
+}
+
+void mmul(limb* r, limb* a, lint an, limb* b, lint bn);
+
+/**
+ * Karatsuba: the product of a and b, both of n limbs, is z2 B^2h +
+ * ((a0 + a1)(b0 + b1) - z0 - z2) B^h + z0, where z0 = a0 b0 and
+ * z2 = a1 b1.
+ */
+void kmul(limb* r, limb* a, limb* b, lint n) {
+    lint h = n / 2;
+    lint m = n - h;
+    limb* sa = calloc(4 * m + 4, sizeof(limb));
+    limb* sb = sa + m + 1;
+    limb* z1 = sb + m + 1;
+    mmul(r, a, h, b, h);
+    mmul(r + 2 * h, a + h, m, b + h, m);
+    memcpy(sa, a + h, m * sizeof(limb));
+    madd(sa, m + 1, a, h);
+    memcpy(sb, b + h, m * sizeof(limb));
+    madd(sb, m + 1, b, h);
+    mmul(z1, sa, m + 1, sb, m + 1);
+    msub(z1, 2 * m + 2, r, 2 * h);
+    msub(z1, 2 * m + 2, r + 2 * h, 2 * m);
+    madd(r + h, n + m, z1, 2 * m + 2 < n + m ? 2 * m + 2 : n + m);
+    free(sa);
+}
+
+/**
+ * Sets the an + bn limbs at r to the product of a and b.
+ */
+void mmul(limb* r, limb* a, lint an, limb* b, lint bn) {
+    uint64_t c;
+    limb* t;
+    lint i;
+    lint j;
+    if (an < bn) {
+        t = a;
+        a = b;
+        b = t;
+        i = an;
+        an = bn;
+        bn = i;
+    }
+    if (bn >= KARATSUBA_MIN) {
+        if (an == bn) {
+            kmul(r, a, b, an);
+            return;
+        }
+        /* in pieces of bn limbs of a */
+        memset(r, 0, (an + bn) * sizeof(limb));
+        t = malloc(2 * bn * sizeof(limb));
+        for (i = 0; i < an; i += bn) {
+            j = an - i < bn ? an - i : bn;
+            mmul(t, a + i, j, b, bn);
+            madd(r + i, an + bn - i, t, j + bn);
+        }
+        free(t);
+        return;
+    }
+    memset(r, 0, (an + bn) * sizeof(limb));
+    for (i = 0; i < bn; i++) {
+        c = 0;
+        for (j = 0; j < an; j++) {
+            c += (uint64_t)a[j] * b[i] + r[i + j];
+            r[i + j] = (limb)c;
+            c >>= 32;
+        }
+        r[i + an] = (limb)c;
+    }
+}
+
+/**
+ * Divides a by b, which has no leading zero limb, into the an - bn + 1
+ * limbs at q and the bn limbs at r (Knuth's algorithm D).
+ */
+void mdiv(limb* q, limb* r, limb* a, lint an, limb* b, lint bn) {
+    limb* u;
+    limb* v;
+    uint64_t p;
+    uint64_t qh;
+    uint64_t rh;
+    int64_t t;
+    int64_t k;
+    lint i;
+    lint j;
+    int s = 0;
+    if (an < bn) {
+        memset(q, 0, sizeof(limb));
+        memset(r, 0, bn * sizeof(limb));
+        memcpy(r, a, an * sizeof(limb));
+        return;
+    }
+    if (bn == 1) {
+        for (p = 0, i = an; i--;) {
+            p = p << 32 | a[i];
+            q[i] = (limb)(p / b[0]);
+            p %= b[0];
+        }
+        r[0] = (limb)p;
+        return;
+    }
+    for (; !(b[bn - 1] << s & 0x80000000u); s++);
+    u = malloc((an + 1 + bn) * sizeof(limb));
+    v = u + an + 1;
+    for (i = bn - 1; i > 0; i--) {
+        v[i] = b[i] << s | (s ? b[i - 1] >> (32 - s) : 0);
+    }
+    v[0] = b[0] << s;
+    u[an] = s ? a[an - 1] >> (32 - s) : 0;
+    for (i = an - 1; i > 0; i--) {
+        u[i] = a[i] << s | (s ? a[i - 1] >> (32 - s) : 0);
+    }
+    u[0] = a[0] << s;
+    for (j = an - bn; j >= 0; j--) {
+        p = (uint64_t)u[j + bn] << 32 | u[j + bn - 1];
+        qh = p / v[bn - 1];
+        rh = p - qh * v[bn - 1];
+        while (qh >> 32 || qh * v[bn - 2] > (rh << 32 | u[j + bn - 2])) {
+            qh--;
+            rh += v[bn - 1];
+            if (rh >> 32) {
+                break;
+            }
+        }
+        for (k = 0, i = 0; i < bn; i++) {
+            p = qh * v[i];
+            t = u[i + j] - k - (int64_t)(p & 0xffffffffu);
+            u[i + j] = (limb)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = u[j + bn] - k;
+        u[j + bn] = (limb)t;
+        q[j] = (limb)qh;
+        if (t < 0) {
+            q[j]--;
+            for (p = 0, i = 0; i < bn; i++) {
+                p += (uint64_t)u[i + j] + v[i];
+                u[i + j] = (limb)p;
+                p >>= 32;
+            }
+            u[j + bn] += (limb)p;
+        }
+    }
+    for (i = 0; i < bn; i++) {
+        r[i] = u[i] >> s | (s ? u[i + 1] << (32 - s) : 0);
+    }
+    free(u);
+}
+
+double b2d(lval x) {
+    struct bview v;
+    double d = 0;
+    lint i;
+    bview(x, &v);
+    for (i = v.n; i--;) {
+        d = d * 4294967296.0 + v.d[i];
+    }
+    return v.s ? -d : d;
+}
+
+int icmp(lval a, lval b) {
+    struct bview x;
+    struct bview y;
+    int c;
+    if (FIXP(a) && FIXP(b)) {
+        return a < b ? -1 : a > b;
+    }
+    bview(a, &x);
+    bview(b, &y);
+    if (x.s != y.s) {
+        return x.s ? -1 : 1;
+    }
+    c = mcmp(x.d, x.n, y.d, y.n);
+    return x.s ? -c : c;
+}
+
+/**
+ * a + b, or a - b if neg. Both are below g on the stack.
+ */
+lval iadd(lval* g, lval a, lval b, int neg) {
+    struct bview x;
+    struct bview y;
+    lval* m;
+    lval r;
+    limb* d;
+    lint n;
+    if (FIXP(a) && FIXP(b) && !(neg ? subo(a, b - 16, &r) : addo(a, b - 16, &r))) {
+        return r;
+    }
+    n = blen(a) > blen(b) ? blen(a) + 1 : blen(b) + 1;
+    m = bnew(g, n);
+    d = (limb*)(m + 3);
+    memset(d, 0, n * sizeof(limb));
+    bview(a, &x);
+    bview(b, &y);
+    y.s ^= neg;
+    if (x.s == y.s || mcmp(x.d, x.n, y.d, y.n) >= 0) {
+        memcpy(d, x.d, x.n * sizeof(limb));
+        (x.s == y.s ? madd : msub)(d, n, y.d, y.n);
+        return bnorm(m, x.s);
+    }
+    memcpy(d, y.d, y.n * sizeof(limb));
+    msub(d, n, x.d, x.n);
+    return bnorm(m, y.s);
+}
+
+lval imul(lval* g, lval a, lval b) {
+    struct bview x;
+    struct bview y;
+    lval* m;
+    lval r;
+    if (FIXP(a) && FIXP(b) && !mulo(a - 16, b >> 5, &r)) {
+        return r + 16;
+    }
+    m = bnew(g, blen(a) + blen(b));
+    bview(a, &x);
+    bview(b, &y);
+    if (!x.n || !y.n) {
+        return 16;
+    }
+    mmul((limb*)(m + 3), x.d, x.n, y.d, y.n);
+    m[2] = x.n + y.n;
+    return bnorm(m, x.s ^ y.s);
+}
+
+/**
+ * Floors a by b, which is not 0, into the quotient g[1] and the remainder
+ * g[2], which it returns. a and b are below g on the stack.
+ */
+lval ifloor(lval* g, lval a, lval b) {
+    struct bview x;
+    struct bview y;
+    lval* m;
+    limb* q;
+    limb* r;
+    lint i = a >> 5;
+    lint j = b >> 5;
+    if (FIXP(a) && FIXP(b) && (j != -1 || i != INTPTR_MIN >> 5)) {
+        lint k = i % j;
+        i /= j;
+        if (k && (k < 0) != (j < 0)) {
+            i--;
+            k += j;
+        }
+        g[1] = i * 32 + 16;
+        return g[2] = k * 32 + 16;
+    }
+    bview(a, &x);
+    bview(b, &y);
+    q = malloc((x.n + y.n + 2) * sizeof(limb));
+    r = q + x.n + 1;
+    mdiv(q, r, x.d, x.n, y.d, y.n);
+    i = x.n < y.n ? 1 : x.n - y.n + 1;
+    g[1] = g[2] = 0;
+    m = bnew(g + 2, i);
+    memcpy(m + 3, q, i * sizeof(limb));
+    g[1] = bnorm(m, x.s ^ y.s);
+    m = bnew(g + 2, y.n);
+    memcpy(m + 3, r, y.n * sizeof(limb));
+    free(q);
+    g[2] = bnorm(m, x.s);
+    if (g[2] != 16 && x.s != y.s) {
+        g[1] = iadd(g + 2, g[1], 48, 1);
+        g[2] = iadd(g + 2, g[2], b, 0);
+    }
+    return g[2];
+}
+
+/**
+ * The L limbs of the two's complement of x at t.
+ */
+void btwos(lval x, limb* t, lint L) {
+    struct bview v;
+    limb one = 1;
+    lint i;
+    bview(x, &v);
+    memset(t, 0, L * sizeof(limb));
+    memcpy(t, v.d, (v.n < L ? v.n : L) * sizeof(limb));
+    if (v.s) {
+        for (i = 0; i < L; i++) {
+            t[i] = ~t[i];
+        }
+        madd(t, L, &one, 1);
+    }
+}
+
+/**
+ * The integer whose two's complement are the L limbs at t.
+ */
+lval bfrom(lval* g, limb* t, lint L) {
+    int s = L && t[L - 1] >> 31;
+    limb one = 1;
+    lint i;
+    if (s) {
+        for (i = 0; i < L; i++) {
+            t[i] = ~t[i];
+        }
+        madd(t, L, &one, 1);
+    }
+    return bmake(g, t, L, s);
+}
+
+/**
+ * Prints x in decimal, nine digits per division of the magnitude by 10^9.
+ */
+void bprint(lval x) {
+    struct bview v;
+    limb* d;
+    char* c;
+    uint64_t r;
+    lint n;
+    lint i;
+    lint k = 0;
+    bview(x, &v);
+    n = v.n;
+    d = malloc(n * sizeof(limb) + n * 10 + 10);
+    c = (char*)(d + n);
+    memcpy(d, v.d, n * sizeof(limb));
+    while (n) {
+        for (r = 0, i = n; i--;) {
+            r = r << 32 | d[i];
+            d[i] = (limb)(r / 1000000000);
+            r %= 1000000000;
+        }
+        for (i = 0; i < 9; i++, r /= 10) {
+            c[k++] = '0' + r % 10;
+        }
+        for (; n && !d[n - 1]; n--);
+    }
+    for (; k > 1 && c[k - 1] == '0'; k--);
+    if (v.s) {
+        putchar('-');
+    }
+    while (k--) {
+        putchar(c[k]);
+    }
+    free(d);
+}
+
+/**
+ * Fixnum arithmetic.
+ * </p>
+ * While all arguments are fixnums, the arithmetic stays on their words.
+ * From the first overflow or bignum it goes on with iadd or imul, and
+ * from the first double with doubles as before.
+ */
+lval lequ(lval* f, lval* h) {
+    lval s = f[1];
+    for (f += 2; f < h; f++)
+        if (FIXP(s) && FIXP(*f) ? s != *f
+            : intp(s) && intp(*f) ? icmp(s, *f) : o2d(s) != o2d(*f))
+            return 0;
+    return TRUE;
+}
+
+lval lless(lval* f, lval* h) {
+    lval s = f[1];
+    for (f += 2; f < h; f++)
+        if (FIXP(s) && FIXP(*f) ? s < *f
+            : intp(s) && intp(*f) ? icmp(s, *f) < 0 : o2d(s) < o2d(*f))
+            s = *f;
+        else
+            return 0;
+    return TRUE;
+}
+
+lval lplus(lval* f, lval* h) {
+    lval s = 16;
+    lval r;
+    double d;
+    for (f++; f < h && FIXP(*f) && !addo(s, *f - 16, &r); f++)
+        s = r;
+    if (f == h)
+        return s;
+    for (h[1] = s; f < h && intp(*f); f++)
+        h[1] = iadd(h + 1, h[1], *f, 0);
+    if (f == h)
+        return h[1];
+    for (d = o2d(h[1]); f < h; f++)
+        d += o2d(*f);
+    return d2o(f, d);
+}
+
+lval lminus(lval* f, lval* h) {
+    lval s = f[1];
+    lval r;
+    double d;
+    if (h - f == 2) {
+        return FIXP(s) && !subo(16, s - 16, &r) ? r
+            : intp(s) ? iadd(h, 16, s, 1) : d2o(f, -o2d(s));
+    }
+    for (f += 2; f < h && FIXP(s) && FIXP(*f) && !subo(s, *f - 16, &r); f++)
+        s = r;
+    if (f == h)
+        return s;
+    for (h[1] = s; f < h && intp(h[1]) && intp(*f); f++)
+        h[1] = iadd(h + 1, h[1], *f, 1);
+    if (f == h)
+        return h[1];
+    for (d = o2d(h[1]); f < h; f++)
+        d -= o2d(*f);
+    return d2o(f, d);
+}
+
+lval ltimes(lval* f, lval* h) {
+    lval s = 48;
+    lval r;
+    double d;
+    for (f++; f < h && FIXP(*f) && !mulo(s - 16, *f >> 5, &r); f++)
+        s = r + 16;
+    if (f == h)
+        return s;
+    for (h[1] = s; f < h && intp(*f); f++)
+        h[1] = imul(h + 1, h[1], *f);
+    if (f == h)
+        return h[1];
+    for (d = o2d(h[1]); f < h; f++)
+        d *= o2d(*f);
+    return d2o(f, d);
+}
+
+/**
+ * Integers divide exactly as long as they leave no remainder.
+ */
+lval ldivi(lval* f, lval* h) {
+    lval* a = f + 2;
+    double s;
+    h[1] = f[1];
+    if (a == h) {
+        h[1] = 48;
+        a--;
+    }
+    for (; a < h && intp(h[1]) && intp(*a) && *a != 16
+        && ifloor(h + 1, h[1], *a) == 16; a++)
+        h[1] = h[2];
+    if (a == h)
+        return h[1];
+    for (s = o2d(h[1]); a < h; a++)
+        s /= o2d(*a);
+    return d2o(a, s);
+}
+
+/**
+ * Bit b of the limbs at t.
+ */
+#define MBIT(t, b) ((t)[(b) / 32] >> (b) % 32 & 1)
+
+lval ldpb(lval* f) {
+    lint s = o2i(car(f[2]));
+    lint p = o2i(cdr(f[2]));
+    lint m = ((lint)1 << (s < 58 ? s : 0)) - 1;
+    limb* t;
+    limb* u;
+    lint L;
+    lint i;
+    lval r;
+    if (FIXP(f[1]) && FIXP(f[3]) && s + p < 58) {
+        return ((f[1] >> 5 & m) << p | (f[3] >> 5 & ~(m << p))) * 32 + 16;
+    }
+    if (!intp(f[1]) || !intp(f[3])) {
+        return d2o(f, (o2i(f[1]) & m) << p | (o2i(f[3]) & ~(m << p)));
+    }
+    L = blen(f[1]) > blen(f[3]) ? blen(f[1]) : blen(f[3]);
+    L = (L > (s + p) / 32 ? L : (s + p) / 32) + 2;
+    t = malloc(2 * L * sizeof(limb));
+    u = t + L;
+    btwos(f[1], t, L);
+    btwos(f[3], u, L);
+    for (i = 0; i < s; i++) {
+        u[(p + i) / 32] = (u[(p + i) / 32] & ~((limb)1 << (p + i) % 32))
+            | (limb)MBIT(t, i) << (p + i) % 32;
+    }
+    r = bfrom(f + 4, u, L);
+    free(t);
+    return r;
+}
+
+lval lldb(lval* f) {
+    lint s = o2i(car(f[1]));
+    lint p = o2i(cdr(f[1]));
+    limb* t;
+    limb* u;
+    lint L;
+    lint i;
+    lval r;
+    if (FIXP(f[2]) && s < 58) {
+        return (f[2] >> 5 >> (p < 63 ? p : 63) & (((lint)1 << s) - 1)) * 32 + 16;
+    }
+    if (!intp(f[2])) {
+        return d2o(f, o2i(f[2]) >> p & ((1LL << s) - 1LL));
+    }
+    L = blen(f[2]) > (s + p) / 32 ? blen(f[2]) : (s + p) / 32;
+    t = calloc(2 * L + 4, sizeof(limb));
+    u = t + L + 2;
+    btwos(f[2], t, L + 2);
+    for (i = 0; i < s; i++) {
+        u[i / 32] |= (limb)MBIT(t, p + i) << i % 32;
+    }
+    r = bmake(f + 3, u, L + 2, 0);
+    free(t);
+    return r;
+}
+
+lval lfloor(lval* f, lval* h) {
+    double n;
+    double d;
+    double q;
+    if (intp(f[1]) && (h - f == 2 || (intp(f[2]) && f[2] != 16))) {
+        ifloor(h, f[1], h - f == 2 ? 48 : f[2]);
+        return mvalues(l2(h + 2, h[1], h[2]));
+    }
+    n = o2d(f[1]);
+    d = h - f > 2 ? o2d(f[2]) : 1;
+    q = floor(n / d);
+    return mvalues(l2(f, d2o(f, q), d2o(f, n - q * d)));
+}
+
+int gensymc = 0;
+lval lgensym(lval* f) {
+    lval* r = ms0(f, 4);
+    r[1] = 20;
+    sprintf((char*)(r + 2),
+        "g%3.3d", gensymc++);
+    return ma(f, 9, 20, s2o(r), 0, 8, 8, 8, -8, 16, 0, 0);
+}
+
+lval lcode_char(lval* f) {
+    uintptr_t c = o2u(f[1]);
+    return c < 256 ? 32 * c + 24 : 0;
+}
+
+lval lchar_code(lval* f) {
+    return f[1] & ~8;
+}
+
+lval lmakef(lval* f) {
+    return d2o(f, f - stack);
+}
+
+lval lfref(lval* f) {
+    return stack[o2i(f[1])];
+}
+
+lval stringify(lval* f, lval l) {
+    int i;
+    lval* r;
+    lval t = l;
+    *++f = l;
+    for (i = 0; t; i++, t = cdr(t));
+    r = ms0(f, i);
+    r[1] = 20;
+    ((char*)r)[i + 16] = 0;
+    for (i = 16; l; i++, l = cdr(l))
+        ((char*)r)[i] = car(l) >> 5;
+    return s2o(r);
+}
+
+lval lstring(lval* f, lval* h) {
+    return stringify(f, rest(h, f + 1));
+}
+
+lval lival(lval* f) {
+    return d2o(f, f[1]);
+}
+
+lval lmakei(lval* f, lval* h) {
+    int i = 2;
+    lint l = o2i(f[1]);
+    lval* r = ma0(h, l);
+    r[1] = f[2] | 4;
+    memset(r + 2, 0, 4 * o2i(f[1]));
+    for (f += 3; f < h; f++, i++) {
+        if (i >= l + 2)
+            printf("overinitializing in makei\n");
+        r[i] = *f;
+    }
+    return a2o(r);
+}
+
+lval liboundp(lval* f) {
+    return o2a(f[1])[o2u(f[2])] == 8 ? 0 : TRUE;
+}
+
+lval limakunbound(lval* f) {
+    o2a(f[1])[o2u(f[2])] = 8;
+    return 0;
+}
+
+lval liref(lval* f) {
+    if (!(f[1] & 2)) {
+        printf("non-iref object\n"); /* Preventing SEGFAULT */
+        return 0;
+    }
+    if (o2u(f[2]) >= o2a(f[1])[0] / 256 + 2) {
+        printf("out of bounds in iref\n");
+    }
+    return ((lval*)(f[1] & ~3))[o2u(f[2])] & ~4;
+}
+
+lval setfiref(lval* f) {
+    lint i = o2i(f[3]);
+    lval* p;
+    if (i >= o2a(f[2])[0] / 256 + 2) {
+        printf("out of bounds in setf iref\n");
+    }
+    p = (lval*)(f[2] & ~3) + i;
+    *p = i == 1 ? f[1] | 4 : f[1];
+    wb(p, f[1]);
+    return *p;
+}
+
+/**
+ * Structure accessors, made by ensure-struct with STRUCT-ACCESSOR: function
+ * objects whose code is lstruct_ref or lstruct_set instead of infn, [3]
+ * being the slot index as a fixnum and [4] the structure class, so that a
+ * slot is read or written without a call to an interpreted function.
+ */
+int sinst(lval x, lval c) {
+    lval k;
+    lval l;
+    if (!ap(x)) {
+        return 0;
+    }
+    k = o2a(x)[1] & ~4;
+    if (k == c) {
+        return 1;
+    }
+    if (!ap(k) || (o2a(k)[1] & ~4) != (o2a(c)[1] & ~4)) {
+        return 0;
+    }
+    for (l = o2a(o2a(k)[2])[5]; l; l = cdr(l)) {
+        if (car(l) == c) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the structure x for the accessor *f, or what the debugger gives */
+int sarg(lval* f, lval* h, lval* x) {
+    lval c = o2a(*f)[4];
+    while (!sinst(*x, c)) {
+        if (dbgr(h, 10, l2(h, *x, o2a(o2a(c)[2])[2]), x)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+lval lstruct_ref(lval* f, lval* h) {
+    lval x = f[1];
+    if (!sarg(f, h, &x)) {
+        return x;
+    }
+    return o2a(x)[o2i(o2a(*f)[3])];
+}
+
+lval lstruct_set(lval* f, lval* h) {
+    lval x = f[2];
+    lval* p;
+    if (!sarg(f, h, &x)) {
+        return x;
+    }
+    p = o2a(x) + o2i(o2a(*f)[3]);
+    wb(p, *p = f[1]);
+    return f[1];
+}
+
+/**
+ * (struct-accessor class index name setterp), the reader or the setf
+ * function of the slot index of the structures of class.
+ */
+lval lstruct_accessor(lval* f, lval* h) {
+    h[0] = f[4] ? ms(h, 3, 212, lstruct_set, (lval)2, (lval)2)
+        : ms(h, 3, 212, lstruct_ref, (lval)1, (lval)1);
+    return ma(h, 5, 212, h[0], f[2], f[1], LVAL_NIL, f[3]);
+}
+
+/**
+ * Generic function dispatch. The discriminating function of a standard
+ * generic function is made by GF-DISPATCHER, a function object whose code
+ * is lgf_dispatch, [3] being the generic function and [4] the function
+ * that computes and calls the effective method when the cache misses.
+ * </p>
+ * The cache is [9] of the info of the generic function, nil or a simple
+ * vector of moved and gfepoch when it was filled, then lines of the keys
+ * of the specialized arguments and the effective method function, nil in
+ * an empty line. The key of an argument is its class when it has one in
+ * [1], else a fixnum telling the built-in type, which decides the class
+ * just as well. A cache filled before objects moved or before
+ * GF-CACHE-FLUSH, called when a class is defined, is emptied.
+ */
+#define GF_LINES        (4)
+#define GF_LINES_MAX    (1024)
+#define GF_PROBE        (4)
+
+lint gfepoch;
+
+lval gkey(lval x) {
+    lval k;
+    switch (x & 3) {
+    case 1:
+        return 512 << 5 | 16;
+    case 2:
+        k = o2a(x)[1] & ~4;
+        return ap(k) ? k : k << 5 | 16;
+    case 3:
+        return (256 + o2s(x)[1]) << 5 | 16;
+    }
+    return (!x ? 513 : (x >> 3 & 3) == 2 ? 514 : 515) << 5 | 16;
+}
+
+int gfresh(lval c) {
+    return o2a(c)[2] == (moved << 5 | 16) && o2a(c)[3] == (gfepoch << 5 | 16);
+}
+
+/* the line of c with the n keys k, or where they go if store */
+lval* gfind(lval c, lval* k, lint n, int store) {
+    lint w = n + 1;
+    lint l = ((o2a(c)[0] >> 8) - 2) / w;
+    uintptr_t u = 0;
+    lint i;
+    lint j;
+    lval* e;
+    for (i = 0; i < n; i++) {
+        u = u * 31 + (k[i] >> 3);
+    }
+    for (j = 0; j < GF_PROBE; j++) {
+        e = o2a(c) + 4 + ((u + j) & (l - 1)) * w;
+        if (!e[n]) {
+            return store ? e : 0;
+        }
+        for (i = 0; i < n && e[i] == k[i]; i++);
+        if (i == n) {
+            return e;
+        }
+    }
+    return 0;
+}
+
+/* an empty cache of l lines for the info v of a generic function */
+lval gcache(lval* g, lval v, lint n, lint l) {
+    lint m = 2 + l * (n + 1);
+    lval* c = ma0(g, m);
+    c[1] = LVAL_IREF_SIMPLE_VECTOR_SUBTYPE;
+    memset(c + 2, 0, m * sizeof(lval));
+    c[2] = moved << 5 | 16;
+    c[3] = gfepoch << 5 | 16;
+    wb(o2a(v) + 9, o2a(v)[9] = a2o(c));
+    return a2o(c);
+}
+
+lval lgf_dispatch(lval* f, lval* h) {
+    lval v = o2a(o2a(*f)[3])[2];
+    lval c = o2a(v)[9];
+    lint n = o2i(o2a(v)[10]);
+    lint d = h - f - 1;
+    lint i;
+    lval* e;
+    if (ap(c) && d >= n && gfresh(c)) {
+        for (i = 0; i < n; i++) {
+            h[i] = gkey(f[i + 1]);
+        }
+        e = gfind(c, h, n, 0);
+        if (e) {
+            return call(f - 1, e[n], d);
+        }
+    }
+    return call(f - 1, o2a(*f)[4], d);
+}
+
+/**
+ * (gf-dispatcher generic-function miss), the discriminating function.
+ */
+lval lgf_dispatcher(lval* f, lval* h) {
+    h[0] = ms(h, 3, 212, lgf_dispatch, LVAL_NIL, (lval)-1);
+    return ma(h, 5, 212, h[0], f[1], f[2], LVAL_NIL, o2a(o2a(f[1])[2])[2]);
+}
+
+/**
+ * (gf-cache-store generic-function emf arguments) remembers emf for the
+ * classes of arguments.
+ */
+lval lgf_cache_store(lval* f, lval* h) {
+    lval v = o2a(f[1])[2];
+    lval c = o2a(v)[9];
+    lint n = o2i(o2a(v)[10]);
+    lval l = f[3];
+    lint i;
+    lval* e;
+    for (i = 0; i < n; i++, l = cdr(l)) {
+        h[i] = gkey(car(l));
+    }
+    if (!ap(c) || !gfresh(c)) {
+        c = gcache(h + n, v, n, GF_LINES);
+    }
+    e = gfind(c, h, n, 1);
+    if (!e) {
+        i = ((o2a(c)[0] >> 8) - 2) / (n + 1);
+        c = gcache(h + n, v, n, i < GF_LINES_MAX ? 2 * i : i);
+        e = gfind(c, h, n, 1);
+    }
+    for (i = 0; i < n; i++) {
+        wb(e + i, e[i] = h[i]);
+    }
+    wb(e + n, e[n] = f[2]);
+    return f[2];
+}
+
+lval lgf_cache_flush(lval* f) {
+    gfepoch++;
+    return LVAL_NIL;
+}
+
+/**
+ * Slot locations. standard-finalize-inheritance gives a class a table
+ * from slot names to locations, [11] of its info, and SLOT-LOCATION finds
+ * there the index of a local slot of an instance of a standard class. A
+ * place that keeps reading or writing the same slot caches that index in a
+ * cons of the table and the index: a slot-value call whose slot name is
+ * quoted, see run_slot, and the accessor methods made by SLOT-READER and
+ * SLOT-WRITER. A class that is redefined gets a new table, so its old
+ * caches miss. A miss, like an unbound slot, goes through slot-value or
+ * its setf function.
+ */
+lval stab(lval x) {
+    lval k;
+    lval v;
+    if (!ap(x)) {
+        return 0;
+    }
+    k = o2a(x)[1] & ~4;
+    if (!ap(k)) {
+        return 0;
+    }
+    v = o2a(k)[2];
+    return ap(v) && o2a(v)[0] >> 8 >= 10 ? o2a(v)[11] : 0;
+}
+
+/* the slot of x at the location cached in e, or 0 */
+lval* sloc(lval x, lval e) {
+    lval v;
+    lint i;
+    if (!cp(e) || stab(x) != car(e)) {
+        return 0;
+    }
+    v = o2a(x)[2];
+    i = cdr(e) >> 5;
+    if (!ap(v) || i >= (o2a(v)[0] >> 8) + 2) {
+        return 0;
+    }
+    return o2a(v) + i;
+}
+
+/* caches in [k] of g[0] the location of the slot g[2] of g[1] */
+void slearn(lval* g, lint k) {
+    lval fn = o2a(symi[110].sym)[5];
+    lval i;
+    lval t;
+    lval e;
+    if (fn == 8 || !stab(g[1])) {
+        return;
+    }
+    g[4] = g[1];
+    g[5] = g[2];
+    i = call(g + 2, fn, 2);
+    t = stab(g[1]);
+    if (!FIXP(i) || !t) {
+        return;
+    }
+    e = o2a(g[0])[k];
+    if (cp(e)) {
+        set_car(e, t);
+        set_cdr(e, i);
+    }
+    else {
+        e = cons(g + 3, t, i);
+        wb(o2a(g[0]) + k, o2a(g[0])[k] = e);
+    }
+}
+
+lval lslot_read(lval* f, lval* h) {
+    lval* p = sloc(car(f[1]), o2a(*f)[4]);
+    if (p && *p != 8) {
+        return *p;
+    }
+    h[0] = *f;
+    h[1] = car(f[1]);
+    h[2] = o2a(*f)[3];
+    slearn(h, 4);
+    p = sloc(h[1], o2a(h[0])[4]);
+    if (p && *p != 8) {
+        return *p;
+    }
+    h[3] = h[2];
+    h[2] = h[1];
+    return call(h, o2a(symi[109].sym)[5], 2);
+}
+
+lval lslot_write(lval* f, lval* h) {
+    lval* p = sloc(cadr(f[1]), o2a(*f)[4]);
+    if (!p) {
+        h[0] = *f;
+        h[1] = cadr(f[1]);
+        h[2] = o2a(*f)[3];
+        slearn(h, 4);
+        p = sloc(h[1], o2a(h[0])[4]);
+    }
+    if (p) {
+        wb(p, *p = car(f[1]));
+        return car(f[1]);
+    }
+    h[3] = car(f[1]);
+    h[4] = cadr(f[1]);
+    h[5] = o2a(*f)[3];
+    return call(h + 1, o2a(symi[109].sym)[6], 3);
+}
+
+/**
+ * (slot-reader slot-name name) and (slot-writer slot-name name), the
+ * functions of the methods of the reader or the writer name of a slot,
+ * [3] being the slot name and [4] the cached location.
+ */
+lval lslot_reader(lval* f, lval* h) {
+    h[0] = ms(h, 3, 212, lslot_read, (lval)2, (lval)2);
+    return ma(h, 5, 212, h[0], f[1], LVAL_NIL, LVAL_NIL, f[2]);
+}
+
+lval lslot_writer(lval* f, lval* h) {
+    h[0] = ms(h, 3, 212, lslot_write, (lval)2, (lval)2);
+    return ma(h, 5, 212, h[0], f[1], LVAL_NIL, LVAL_NIL, f[2]);
+}
+
+lval lmakej(lval* f) {
+    lval* r = mb0(f, o2i(f[1]));
+    r[1] = o2i(f[2]);
+    memset(r + 2, 0, (o2i(f[1]) + 7) / 8);
+    //memset(r + 2, 0, (o2i(f[1]) + 15) / 16);
+    return s2o(r);
+}
+
+lval ljref(lval* f) {
+    uintptr_t i = o2u(f[2]);
+    return i ? w2o(f, o2s(f[1])[i]) : d2o(f, o2s(f[1])[0] & ~LVAL_GCM_BIT);
+}
+
+lval setfjref(lval* f) {
+    return o2s(f[2])[o2u(f[3])] = o2u(f[1]);
+}
+
+lval strf(lval* f, const char* s);
+
+/**
+ * Open file streams by number: 0, 1 and 2 are the standard streams.
+ * Numbers are not reused, so that a stream saved in an image is closed
+ * when the image is restored. A stream reads and writes through fp, or
+ * reads the n bytes of map from pos.
+ */
+struct fstream {
+    FILE* fp;
+    char* map;
+    size_t n;
+    size_t pos;
+} *fsv;
+lint fsc;
+lint fsn;
+
+lval fsnew(FILE* fp, char* map, size_t n) {
+    if (fsc == fsn) {
+        fsv = realloc(fsv, (fsn = fsn ? 2 * fsn : 16) * sizeof(struct fstream));
+    }
+    fsv[fsc].fp = fp;
+    fsv[fsc].map = map;
+    fsv[fsc].n = n;
+    fsv[fsc].pos = 0;
+    return fsc++;
+}
+
+/**
+ * Numbers the standard streams, and closes the others below n.
+ */
+void fsinit(lint n) {
+    fsc = 0;
+    fsnew(stdin, NULL, 0);
+    fsnew(stdout, NULL, 0);
+    fsnew(stderr, NULL, 0);
+    while (fsc < n) {
+        fsnew(NULL, NULL, 0);
+    }
+}
+
+#ifdef _WIN32
+char* mapf(int fd, size_t* n) {
+    return NULL;
+}
+#else
+/**
+ * Maps the regular file fd for reading, or returns NULL.
+ */
+char* mapf(int fd, size_t* n) {
+    struct stat st;
+    char* m;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+        return NULL;
+    }
+    m = mmap(NULL, *n = st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    return m == MAP_FAILED ? NULL : m;
+}
+#endif
+
+#define FSS(x) (fsv + o2s(x)[5])
+
+#ifdef _WIN32
+/**
+ * A file stream is [handle, output flag, number in fsv]. Input goes
+ * through a block buffer of stream_buffer bytes held in map, of which n
+ * bytes were read and pos consumed, so read-line scans the buffer for the
+ * newline instead of calling ReadFile for each character.
+ */
+lval lmake_fs(lval* f) {
+    HANDLE fd = CreateFile(o2z(f[1]), f[2] ? GENERIC_WRITE :
+        GENERIC_READ, f[2] ? FILE_SHARE_WRITE : FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    return ms(f, 4, 116, 1, fd, f[2], fsnew(NULL, NULL, 0));
+}
+
+lval lclose_fs(lval* f) {
+    struct fstream* t = FSS(f[1]);
+    free(t->map);
+    t->map = NULL;
+    t->n = t->pos = 0;
+    CloseHandle(o2s(f[1])[3]);
+    return 0;
+}
+
+/**
+ * Refills the block buffer of the stream t from the handle h once it is
+ * consumed; returns 0 at the end of the file.
+ */
+int fsfill(struct fstream* t, HANDLE h) {
+    DWORD l = 0;
+    if (t->pos < t->n) {
+        return 1;
+    }
+    if (!t->map) {
+        t->map = malloc(stream_buffer ? stream_buffer : 1);
+    }
+    t->n = t->pos = 0;
+    if (!ReadFile(h, t->map, stream_buffer ? (DWORD)stream_buffer : 1, &l, NULL)) {
+        return 0;
+    }
+    t->n = l;
+    return l != 0;
+}
+
+lval llisten_fs(lval* f) {
+    if (FSS(f[1])->pos < FSS(f[1])->n) {
+        return TRUE;
+    }
+    return WaitForSingleObject(o2s(f[1])[3], 0) == WAIT_OBJECT_0 ? TRUE : 0;
+}
+
+/**
+ * Reads into the string f[2] from f[3] up to the end f[4] or of the
+ * string, returning the count: what the block buffer holds first, else
+ * straight from the handle.
+ */
+lval lread_fs(lval* f, lval* h) {
+    lint l = o2i(f[3]);
+    lint e = h - f > 4 ? o2i(f[4]) : (o2s(f[2])[0] >> 6) - 4;
+    struct fstream* t = FSS(f[1]);
+    DWORD r;
+    if (t->pos < t->n) {
+        e = e - l < (lint)(t->n - t->pos) ? e - l : (lint)(t->n - t->pos);
+        memcpy(o2z(f[2]) + l, t->map + t->pos, e);
+        t->pos += e;
+        return d2o(f, e);
+    }
+    if (!ReadFile(o2s(f[1])[3], o2z(f[2]) + l, (DWORD)(e - l), &r, NULL))
+        return 0;
+    return d2o(f, r);
+}
+
+/**
+ * Reads a line into a string without its newline, or nil at the end of
+ * the file; the second value tells whether the end of the file ended the
+ * line. Each block is searched for the newline with memchr.
+ */
+lval lreadl_fs(lval* f) {
+    static char* b;
+    static size_t m;
+    struct fstream* t = FSS(f[1]);
+    size_t n = 0;
+    size_t k;
+    char* p;
+    char* q = NULL;
+    lval* s;
+    while (!q && fsfill(t, o2s(f[1])[3])) {
+        p = t->map + t->pos;
+        q = memchr(p, '\n', t->n - t->pos);
+        k = q ? q - p : t->n - t->pos;
+        if (n + k > m) {
+            b = realloc(b, m = 2 * (n + k));
+        }
+        memcpy(b + n, p, k);
+        n += k;
+        t->pos += k + (q != NULL);
+    }
+    if (!q && !n) {
+        return mvalues(l2(f, 0, TRUE));
+    }
+    s = ms0(f, n);
+    s[1] = 20;
+    memcpy(s + 2, b, n);
+    ((char*)(s + 2))[n] = 0;
+    f[1] = s2o(s);
+    return mvalues(l2(f + 1, f[1], q ? 0 : TRUE));
+}
+
+lval lwrite_fs(lval* f) {
+    int l = o2i(f[3]);
+    if (!WriteFile(o2s(f[1])[3],
+        o2z(f[2]) + l, o2i(f[4]) - l, &l, NULL))
+        return 0;
+    return d2o(f, l);
+}
+
+lval lfinish_fs(lval* f) {
+    FlushFileBuffers(o2s(f[1])[3]);
+    return 0;
+}
+
+lval lfasl(lval* f) {
+    HMODULE h = LoadLibrary(o2z(f[1]));
+    FARPROC s = h ? GetProcAddress(h, "init") : NULL;
+    if (!s) {
+        return 0;
+    }
+    return s(f);
+}
+
+lval luname(lval* f) {
+    OSVERSIONINFO osvi;
+    osvi.dwOSVersionInfoSize = sizeof(OSVERSIONINFO);
+#pragma warning(suppress : 4996)    GetVersionEx(&osvi);
+    f[1] = cons(f + 1, strf(f + 1, osvi.szCSDVersion), 0);
+    f[1] = cons(f + 1, d2o(f + 1, osvi.dwBuildNumber), f[1]);
+    f[1] = cons(f + 1, d2o(f + 1, osvi.dwMinorVersion), f[1]);
+    return cons(f + 1, d2o(f, osvi.dwMajorVersion), f[1]);
+}
+
+#else /* unix */
+
+/**
+ * A file stream is [fd, output flag, number in fsv]: reads and writes go
+ * through a stdio buffer of stream_buffer bytes, so a stream read or
+ * written a character at a time costs a call, not a system call. The
+ * standard streams share stdin, stdout and stderr with the reader and
+ * print, which keeps their output in order; exit flushes them all.
+ */
+#define FSP(x) (fsv[o2s(x)[5]].fp)
+
+/**
+ * An input file that can be mapped is read straight out of the mapping,
+ * the other files through stdio.
+ */
+lval lmake_fs(lval* f) {
+    int fd = open(o2z(f[1]), f[2] ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY, 0600);
+    size_t n = 0;
+    char* m = fd >= 0 && !f[2] ? mapf(fd, &n) : NULL;
+    FILE* fp = m || fd < 0 ? NULL : fdopen(fd, f[2] ? "w" : "r");
+    int e = errno;
+    if (!m && !fp) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return d2o(f, e);
+    }
+    if (fp) {
+        setvbuf(fp, NULL, stream_buffer ? _IOFBF : _IONBF, stream_buffer);
+    }
+    return ms(f, 4, 116, (lval)1, (lval)fd, f[2], fsnew(fp, m, n));
+}
+
+lval lclose_fs(lval* f) {
+    struct fstream* s = FSS(f[1]);
+    if (s->map) {
+        munmap(s->map, s->n);
+        close(o2s(f[1])[3]);
+        s->map = NULL;
+    }
+    else if (s->fp && o2s(f[1])[5] > 2) {
+        fclose(s->fp);
+        s->fp = NULL;
+    }
+    else if (s->fp) {
+        fflush(s->fp);
+    }
+    return 0;
+}
+
+/**
+ * Whether the stdio buffer of fp holds input, as gnulib's freadahead
+ * finds out; 0 where the FILE is opaque.
+ */
+int fbuffered(FILE* fp) {
+#if defined __GLIBC__
+    return fp->_IO_read_ptr < fp->_IO_read_end;
+#elif defined __APPLE__ || defined __FreeBSD__ || defined __NetBSD__ || defined __OpenBSD__
+    return fp->_r > 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Whether a read would not block and not hit the end: the buffer holds a
+ * character, or poll finds the fd readable and the character read is not
+ * EOF. The fd's flags are left alone, as stdin may be shared.
+ */
+lval llisten_fs(lval* f) {
+    FILE* fp = FSP(f[1]);
+    struct pollfd p;
+    int c;
+    if (FSS(f[1])->map) {
+        return FSS(f[1])->pos < FSS(f[1])->n ? TRUE : 0;
+    }
+    if (!fp) {
+        return 0;
+    }
+    if (!fbuffered(fp)) {
+        p.fd = (int)o2s(f[1])[3];
+        p.events = POLLIN;
+        if (poll(&p, 1, 0) <= 0) {
+            return 0;
+        }
+    }
+    c = getc(fp);
+    if (c == EOF) {
+        clearerr(fp);
+        return 0;
+    }
+    ungetc(c, fp);
+    return TRUE;
+}
+
+/**
+ * Reads into the string f[2] from f[3] up to the end f[4] or of the
+ * string, returning the count.
+ */
+lval lread_fs(lval* f, lval* h) {
+    lint l = o2i(f[3]);
+    lint e = h - f > 4 ? o2i(f[4]) : (o2s(f[2])[0] >> 6) - 4;
+    FILE* fp = FSP(f[1]);
+    struct fstream* s = FSS(f[1]);
+    if (s->map) {
+        e = e - l < (lint)(s->n - s->pos) ? e - l : (lint)(s->n - s->pos);
+        memcpy(o2z(f[2]) + l, s->map + s->pos, e);
+        s->pos += e;
+        return d2o(f, e);
+    }
+    if (!fp) {
+        return 16;
+    }
+    l = fread(o2z(f[2]) + l, 1, e - l, fp);
+    if (!l && ferror(fp)) {
+        clearerr(fp);
+        return cons(f, errno, 0);
+    }
+    return d2o(f, l);
+}
+
+/**
+ * Reads a line into a string without its newline, or nil at the end of
+ * the file; the second value tells whether the end of the file ended the
+ * line. getline finds the newline in the stdio buffer with memchr, and
+ * a mapped file is searched in place.
+ */
+lval lreadl_fs(lval* f) {
+    static char* b;
+    static size_t m;
+    FILE* fp = FSP(f[1]);
+    struct fstream* t = FSS(f[1]);
+    ssize_t n;
+    int e;
+    lval* s;
+    if (t->map) {
+        char* p = t->map + t->pos;
+        char* q = t->pos < t->n ? memchr(p, '\n', t->n - t->pos) : NULL;
+        n = q ? q - p : (ssize_t)(t->n - t->pos);
+        if (!q && !n) {
+            return mvalues(l2(f, 0, TRUE));
+        }
+        s = ms0(f, n);
+        s[1] = 20;
+        memcpy(s + 2, p, n);
+        ((char*)(s + 2))[n] = 0;
+        t->pos += n + (q != NULL);
+        f[1] = s2o(s);
+        return mvalues(l2(f + 1, f[1], q ? 0 : TRUE));
+    }
+    n = fp ? getline(&b, &m, fp) : -1;
+    if (n <= 0) {
+        if (fp) {
+            clearerr(fp);
+        }
+        return mvalues(l2(f, 0, TRUE));
+    }
+    e = b[n - 1] != '\n';
+    n -= !e;
+    s = ms0(f, n);
+    s[1] = 20;
+    memcpy(s + 2, b, n);
+    ((char*)(s + 2))[n] = 0;
+    f[1] = s2o(s);
+    return mvalues(l2(f + 1, f[1], e ? TRUE : 0));
+}
+
+lval lwrite_fs(lval* f) {
+    lint l = o2i(f[3]);
+    FILE* fp = FSP(f[1]);
+    if (!fp) {
+        return 16;
+    }
+    l = fwrite(o2z(f[2]) + l, 1, o2i(f[4]) - l, fp);
+    if (ferror(fp)) {
+        clearerr(fp);
+        return cons(f, errno, 0);
+    }
+    return d2o(f, l);
+}
 
-lval ldpb(lval* f) {
-    lint s = o2i(car(f[2]));
-    lint p = o2i(cdr(f[2]));
-    lint m = (1LL << s) - 1LL;
-    return d2o(f, (o2i(f[1]) & m) << p | (o2i(f[3]) & ~(m << p)));
+lval lfinish_fs(lval* f) {
+    if (FSP(f[1])) {
+        fflush(FSP(f[1]));
+        fsync(o2s(f[1])[3]);
+    }
+    return 0;
 }
 
-lval lldb(lval* f) {
-    lint s = o2i(car(f[1]));
-    lint p = o2i(cdr(f[1]));
-    return d2o(f, o2i(f[2]) >> p & ((1LL << s) - 1LL));
+lval lfasl(lval* f) {
+    void* h = dlopen(o2z(f[1]), RTLD_NOW);
+    lval(*s) () = h ? (lval(*) ())dlsym(h, "init") : NULL;
+    if (!s) {
+        fprintf(stderr, "%s\n", dlerror());
+        return 0;
+    }
+    return s(f);
 }
 
-lval lfloor(lval* f, lval* h) {
-    double n = o2d(f[1]);
-    double d = h - f > 2 ? o2d(f[2]) : 1;
-    double q = floor(n / d);
-    return mvalues(l2(f, d2o(f, q), d2o(f, n - q * d)));
+lval luname(lval* f) {
+    struct utsname un;
+    uname(&un);
+    f[1] = cons(f + 1, strf(f + 1, un.machine), 0);
+    f[1] = cons(f + 1, strf(f + 1, un.version), f[1]);
+    f[1] = cons(f + 1, strf(f + 1, un.release), f[1]);
+    return cons(f + 1, strf(f, un.sysname), f[1]);
 }
+#endif
 
-int gensymc = 0;
-lval lgensym(lval* f) {
-    lval* r = ms0(f, 4);
-    r[1] = 20;
-    sprintf((char*)(r + 2),
-        "g%3.3d", gensymc++);
-    return ma(f, 9, 20, s2o(r), 0, 8, 8, 8, -8, 16, 0, 0);
+/**
+ * The reader reads from ins, or from the file mapped at inp up to ine.
+ */
+FILE* ins;
+const char* inp;
+const char* ine;
+
+/**
+ * Evaluates the forms of the file s, or passes them to the function fn.
+ */
+void load(lval* f, char* s, lval fn) {
+    lval r;
+    FILE* oldins = ins;
+    const char* oldp = inp;
+    const char* olde = ine;
+    int fd = open(s, O_RDONLY);
+    size_t n;
+    char* m = fd >= 0 ? mapf(fd, &n) : NULL;
+    ins = m || fd < 0 ? NULL : fdopen(fd, "r");
+    inp = m;
+    ine = m ? m + n : NULL;
+    if (m || ins) {
+        while ((r = lread(f)) != 8) {
+            if (fn) {
+                f[2] = r;
+                call(f, fn, 1);
+            }
+            else {
+                eval(f, r);
+            }
+        }
+    }
+    if (ins) {
+        fclose(ins);
+    }
+    else if (fd >= 0) {
+#ifndef _WIN32
+        if (m) {
+            munmap(m, n);
+        }
+#endif
+        close(fd);
+    }
+    ins = oldins;
+    inp = oldp;
+    ine = olde;
 }
 
-lval lcode_char(lval* f) {
-    uintptr_t c = o2u(f[1]);
-    return c < 256 ? 32 * c + 24 : 0;
+lval lload(lval* f, lval* h) {
+    load(h, o2z(f[1]), h - f > 2 ? f[2] : 0);
+    return symi[1].sym;
 }
 
-lval lchar_code(lval* f) {
-    return f[1] & ~8;
+lval lstring_equal(lval* f) {
+    return string_equal(f[1], f[2]) ? TRUE : 0;
 }
 
-lval lmakef(lval* f) {
-    return d2o(f, f - stack);
+lval copy_code(lval*, lval);
+
+lval leval(lval* f, lval* h) {
+    f[1] = copy_code(h, f[1]);
+    f[-1] = h - f > 2 ? f[2] : 0;
+    return eval(f - 1, f[1]);
 }
 
-lval lfref(lval* f) {
-    return stack[o2i(f[1])];
+void psym(lval p, lval n) {
+    int i;
+    if (!p) {
+        printf("#:");
+    }
+    else if (p != pkg) {
+        lval m = car(o2a(p)[2]);
+        for (i = 0; i < o2s(m)[0] / 64 - 4; i++) {
+            putchar(o2z(m)[i]);
+        }
+        putchar(':');
+    }
+
+    for (i = 0; i < o2s(n)[0] / 64 - 4; i++) {
+        putchar(o2z(n)[i]);
+    }
 }
 
-lval stringify(lval* f, lval l) {
+void print(lval x) {
     int i;
-    lval* r;
-    lval t = l;
-    *++f = l;
-    for (i = 0; t; i++, t = cdr(t));
-    r = ms0(f, i);
-    r[1] = 20;
-    ((char*)r)[i + 16] = 0;
-    for (i = 16; l; i++, l = cdr(l))
-        ((char*)r)[i] = car(l) >> 5;
-    return s2o(r);
+    switch (x & 3) {
+    case 0:
+        if (x) {
+            if (x & 8) {
+                if (LVAL_AS_INT(x) < 256 && isgraph(LVAL_AS_INT(x))) {
+                    printf("#\\%c", x >> 5);
+                }
+                else {
+                    printf("#\\U+%lld", x >> 5);
+                }
+            }
+            else {
+                printf("%lld", x >> 5);
+            }
+        }
+        else {
+            printf("nil");
+        }
+        break;
+    case 1:
+        printf("(");
+        print(car(x));
+        for (x = cdr(x); cp(x); x = cdr(x)) {
+            printf(" ");
+            print(car(x));
+        }
+        if (x) {
+            printf(" . ");
+            print(x);
+        }
+        printf(")");
+        break;
+    case 2:
+        switch (o2a(x)[1]) {
+        case 212:
+            printf("#<function ");
+            print(o2a(x)[6]);
+            printf(">");
+            break;
+        case 20:
+            psym(o2a(x)[9], o2a(x)[2]);
+            break;
+        case 116:
+            printf("#(");
+            for (i = 0; i < o2a(x)[0] >> 8; i++) {
+                if (i)
+                    printf(" ");
+                print(o2a(x)[i + 2]);
+            }
+            printf(")");
+            break;
+        case LVAL_IREF_CODE_SUBTYPE:
+            print(o2a(x)[3]);
+            break;
+        case 180:
+            printf("#<package ");
+            print(car(o2a(x)[2]));
+            printf(">");
+            break;
+        default:
+            if (ap(o2a(x)[1])) {
+                printf("#<");
+                print(o2a(o2a(o2a(x)[1] - 4)[2])[2]);
+                printf(">");
+            }
+            else {
+                printf("#(");
+                for (i = 0; i <= o2a(x)[0] >> 8; i++)
+                    print(o2a(x)[i + 1]);
+                printf(")");
+            }
+        } break;
+    case 3:
+        switch (o2s(x)[1]) {
+        case 20:
+            printf("\"");
+            for (i = 0; i < o2s(x)[0] / 64 - 4; i++) {
+                char c = o2z(x)[i];
+                printf((c == '\\' || c == '\"' ? "\\%c" : "%c"), c);
+            } printf("\"");
+            break;
+        case 84:
+            printf("%g", o2d(x));
+            break;
+        case LVAL_JREF_BIGNUM_SUBTYPE:
+            bprint(x);
+        }
+    }
+}
+
+lval lprint(lval* f) {
+    print(f[1]);
+    return f[1];
+}
+
+lval lexit(lval* f) {
+    lval x = f[1];
+    lint code = (0 == (x & 3)) ? x >> 5 : 0;
+    exit((int)code);
+    return 0;
+}
+
+static void print_with_desc(const char* what, lval v) {
+    printf("; %s ", what);
+    if (v != 8) {
+        print(v);
+    }
+    else {
+        printf("<UNBOUND>");
+    }
+    printf("\n");
+}
+
+lval linspect(lval* f) {
+    lval x = f[0];
+    printf(";; The object is a ");
+    switch (x & 3) {
+    case 0:
+        if (x == 0) {
+            printf("NIL");
+        }
+        else if (x & 8) {
+            printf("CHAR");
+        }
+        else {
+            printf("FIXNUM");
+        }
+        break;
+    case 1:
+        printf("CONS");
+        break;
+    case 2:
+        switch (o2a(x)[1]) {
+        case 212:
+            printf("FUNCTION");
+            break;
+        case 20:
+            printf("SYMBOL");
+            break;
+        case 116:
+            printf("ARRAY");
+            break;
+        case 180:
+            printf("PACKAGE");
+            break;
+        default:
+            printf("UNKNOWN-IREF(%Id)", o2a(x)[1]);
+        }
+        break;
+    case 3:
+        switch (o2s(x)[1]) {
+        case 20:
+            printf("SIMPLE-STRING");
+            break;
+        case 84:
+            printf("DOUBLE");
+            break;
+        case LVAL_JREF_BIGNUM_SUBTYPE:
+            printf("BIGNUM");
+            break;
+        }
+    }
+    printf(".\n");
+    if ((x & 3) == 2 && o2a(x)[1] == 20) {
+        /* symbol extra info */
+        print_with_desc("Name is", o2a(x)[2]);
+        print_with_desc("Package is", o2a(x)[9]);
+        print_with_desc("Value is", o2a(x)[4]);
+        print_with_desc("Function is", o2a(x)[5]);
+        print_with_desc("Macro is ", o2a(x)[6]);
+    }
+    return 0;
 }
 
-lval lstring(lval* f, lval* h) {
-    return stringify(f, rest(h, f + 1));
+int ep(lval* g, lval expr) {
+    int i;
+    lval v = rvalues(g, eval(g, expr));
+    if (car(v) == 8) {
+        return 0;
+    }
+    if (v) {
+        for (i = 0; v; v = cdr(v)) {
+            printf(";%d: ", i++);
+            print(car(v));
+            printf("\n");
+        }
+    }
+    else {
+        printf(";no values\n");
+    }
+    return 1;
 }
 
-lval lival(lval* f) {
-    return d2o(f, f[1]);
-}
+char* exmsg[] = {
+    "variable unbound",
+    "function unbound",
+    "array index out of bounds",
+    "go tag not bound",
+    "block name not bound",
+    "catch tag not dynamically bound",
+    "too many arguments",
+    "too few arguments",
+    "dynamic extent of block exited",
+    "dynamic extent of tagbody exited",
+    "wrong type of argument"
+};
 
-lval lmakei(lval* f, lval* h) {
-    int i = 2;
-    lint l = o2i(f[1]);
-    lval* r = ma0(h, l);
-    r[1] = f[2] | 4;
-    memset(r + 2, 0, 4 * o2i(f[1]));
-    for (f += 3; f < h; f++, i++) {
-        if (i >= l + 2)
-            printf("overinitializing in makei\n");
-        r[i] = *f;
+X int dbgr(lval* f, int x, lval val, lval* vp) {
+    lval ex;
+    lint i;
+    lval* h = f;
+    lint l = 0;
+    NF(0) ex = o2a(symi[59].sym)[5];
+    if (ex != 8) {
+        h++;
+        *++h = d2o(f, x);
+        *++h = val;
+        ex = call(f, ex, h - f - 1);
+        longjmp(top_jmp, 1);
+    }
+    printf(";exception: %s ", exmsg[x]);
+    if (val)
+        print(val);
+    printf("\n;restarts:\n;[t]oplevel\n;[u]se <form> instead\n;[r]eturn <form> from function\n");
+    while (1) {
+        lval* j;
+        printf(";%Id> ", l);
+        ex = lread(g);
+        if (ex == 8)
+            longjmp(top_jmp, 1);
+        if (sp(ex) && o2s(ex)[1] == 84) {
+            for (h = f, l = i = o2i(ex); i; i--) {
+                if (!h[2])
+                    break;
+                h = o2a(h[2]);
+            }
+        }
+        else if (ap(ex) && o2a(ex)[1] == 20) {
+            switch (o2z(o2a(ex)[2])[0]) {
+            case 'B':
+                printf(";backtrace:\n");
+                j = f;
+                for (i = 0; j; i++) {
+                    printf(";%Id: ", i);
+                    if (j[0] >> 5 == 4) {
+                        print(o2a(j[5])[6]);
+                        printf(" ");
+                        print(j[4]);
+                    } printf("\n");
+                    if (!j[2])
+                        break;
+                    j = o2a(j[2]);
+                } break;
+            case 'R':
+                *vp = eval(g, lread(g));
+                return 1;
+            case 'T':
+                longjmp(top_jmp, 1);
+            case 'U':
+                *vp = eval(g, lread(g));
+                return 0;
+            }
+        }
+        else
+            ep(h, ex);
     }
-    return a2o(r);
 }
 
-lval liboundp(lval* f) {
-    return o2a(f[1])[o2u(f[2])] == 8 ? 0 : TRUE;
-}
+/**
+ * Compiled code.
+ * </p>
+ * evca does not walk a form each time it is evaluated. The first time, it
+ * compiles the form into a tree of nodes and displaces the form with it,
+ * the same way macro calls are displaced by their expansion, so the code
+ * of a function carries its own compiled body. A node is an iref of this
+ * subtype: [2] selects the C function that runs it, [3] is the source
+ * form, which is what prints and what copy_code gives back, and the rest
+ * are its operands:
+ * </p>
+ * NODE_CONST [4] the value.
+ * NODE_VAR [4] the expansion of a symbol macro, [5] the address.
+ * NODE_CALL [4] the expansion of a macro, [5] the address of the operator
+ * and [6]... the arguments, 0 until the call first runs with a function as
+ * the operator. A literal control string of format is compiled as
+ * (formatter control-string), which expands it once.
+ * NODE_IF [4] the test, [5] then, [6] else.
+ * NODE_PROGN [4]... the forms.
+ * NODE_SETQ [4]... the symbol, address and value of each pair.
+ * NODE_SPECIAL [4] the special operator, which gets the source's cdr,
+ * whose forms are compiled as the operator evaluates them.
+ * NODE_MACRO [4] the expansion.
+ * NODE_SLOT a call of slot-value with a quoted slot name, like NODE_CALL
+ * but [4] caches the location of the slot, see run_slot.
+ * </p>
+ * Macros are expanded when a call is first run, as before, and the node
+ * then becomes a NODE_MACRO, so the arguments of a macro are never
+ * compiled: they need not be code at all. An address is 0 while unresolved, then the
+ * position of the binding in the environment, or -1 for the global one.
+ * The environment has the same shape every time a piece of code is
+ * evaluated, so running a node only takes that many cdrs and checks that
+ * the entry still binds the symbol. That holds as long as no code is
+ * shared between places, so macro expansions and forms given to eval are
+ * copied first.
+ */
+#define NODE_CONST      (0)
+#define NODE_VAR        (1)
+#define NODE_CALL       (2)
+#define NODE_IF         (3)
+#define NODE_PROGN      (4)
+#define NODE_SETQ       (5)
+#define NODE_SPECIAL    (6)
+#define NODE_MACRO      (7)
+#define NODE_SLOT       (8)
 
-lval limakunbound(lval* f) {
-    o2a(f[1])[o2u(f[2])] = 8;
-    return 0;
-}
+/**
+ * The lists being copied by copy_list, innermost first.
+ */
+struct cpath {
+    lval* x;
+    struct cpath* up;
+};
 
-lval liref(lval* f) {
-    if (!(f[1] & 2)) {
-        printf("non-iref object\n"); /* Preventing SEGFAULT */
-        return 0;
-    }
-    if (o2u(f[2]) >= o2a(f[1])[0] / 256 + 2) {
-        printf("out of bounds in iref\n");
+/**
+ * Copies the list x and the lists in it, unless x is one of the lists on
+ * the path up, so a circular list, which can only be the argument of a
+ * macro, is shared instead of copied forever. W follows V at half speed
+ * to find a circular tail.
+ */
+lval copy_list(lval* f, lval x, struct cpath* up) {
+    struct cpath p;
+    lint i = 0;
+    NF(4) T = U = 0;
+    f[1] = V = W = x;
+    for (p.up = up; up; up = up->up) {
+        if (*up->x == x) {
+            return x;
+        }
     }
-    return ((lval*)(f[1] & ~3))[o2u(f[2])] & ~4;
+    p.x = f + 1;
+    do {
+        x = nodep(car(V)) ? o2a(car(V))[3] : car(V);
+        x = cp(x) && car(x) != symi[12].sym ? copy_list(g, x, &p) : x;
+        x = cons(g, x, 0);
+        if (U) {
+            set_cdr(U, x);
+        }
+        else {
+            T = x;
+        }
+        U = x;
+        V = cdr(V);
+        W = i++ & 1 ? cdr(W) : W;
+    } while (cp(V) && car(V) != symi[12].sym && V != W);
+    x = nodep(V) ? o2a(V)[3] : V;
+    set_cdr(U, cp(x) && car(x) != symi[12].sym && V != W ? copy_list(g, x, &p) : x);
+    return T;
 }
 
-lval setfiref(lval* f) {
-    lint i = o2i(f[3]);
-    if (i >= o2a(f[2])[0] / 256 + 2) {
-        printf("out of bounds in setf iref\n");
+/**
+ * Copies the conses of the code x, but not of quoted data, and turns
+ * nodes back into their source.
+ */
+lval copy_code(lval* f, lval x) {
+    if (nodep(x)) {
+        x = o2a(x)[3];
     }
-    return ((lval*)(f[2] & ~3))[i] = i == 1 ? f[1] | 4 : f[1];
+    return cp(x) && car(x) != symi[12].sym ? copy_list(f, x, 0) : x;
 }
 
-lval lmakej(lval* f) {
-    lval* r = mb0(f, o2i(f[1]));
-    r[1] = o2i(f[2]);
-    memset(r + 2, 0, (o2i(f[1]) + 7) / 8);
-    //memset(r + 2, 0, (o2i(f[1]) + 15) / 16);
-    return s2o(r);
+/**
+ * Looks the symbol s up in the namespace type, using and updating the
+ * address at k. Returns the binding's cell, or 0 for a macro.
+ */
+lval* laddr(lval* f, lval s, lval* k, int type) {
+    lval env = E;
+    lval e;
+    lint i;
+    if (*k) {
+        i = *k >> 5;
+        if (i < 0) {
+            if (!((o2a(s)[8] >> type) & 32)) {
+                return o2a(s) + 4 + type;
+            }
+        }
+        else {
+            for (; i && env; i--) {
+                env = cdr(env);
+            }
+            e = caar(env);
+            if (type || cp(e) ? car(e) == s && (cdr(e) >> 4) == type : e == s) {
+                return o2c(car(env)) + 1;
+            }
+        }
+    }
+    for (i = 0, env = E; env; env = cdr(env), i++) {
+        e = caar(env);
+        if (type || cp(e) ? car(e) == s && (cdr(e) >> 4) == type : e == s) {
+            break;
+        }
+    }
+    if (env ? cp(e) && cdr(e) & 32 : (o2a(s)[8] >> type) & 32) {
+        *k = 0;
+        return 0;
+    }
+    if (!env) {
+        *k = -32 | 16;
+        return o2a(s) + 4 + type;
+    }
+    *k = (i << 5) | 16;
+    return o2c(car(env)) + 1;
 }
 
-lval ljref(lval* f) {
-    return d2o(f, o2s(f[1])[o2u(f[2])]);
+lval node(lval* f, lint op, lval src, lint n) {
+    lval* m = ma0(f, n + 2);
+    m[1] = LVAL_IREF_CODE_SUBTYPE;
+    m[2] = (op << 5) | 16;
+    m[3] = src;
+    memset(m + 4, 0, n * sizeof(lval));
+    return a2o(m);
 }
 
-lval setfjref(lval* f) {
-    return o2s(f[2])[o2u(f[3])] = o2u(f[1]);
+lint nforms(lval l) {
+    lint n = 0;
+    for (; cp(l); l = cdr(l)) {
+        n++;
+    }
+    return n;
 }
 
-lval strf(lval* f, const char* s);
-
-#ifdef _WIN32
-lval lmake_fs(lval* f) {
-    HANDLE fd = CreateFile(o2z(f[1]), f[2] ? GENERIC_WRITE :
-        GENERIC_READ, f[2] ? FILE_SHARE_WRITE : FILE_SHARE_READ, NULL, OPEN_EXISTING,
-        FILE_ATTRIBUTE_NORMAL, NULL);
-    return ms(f, 4, 116, 1, fd, f[2], 0);
+lval comp(lval* f, lval x) {
+    lval s;
+    lint i;
+    lint n;
+    NF(3) T = x;
+    U = V = 0;
+    if (!cp(x)) {
+        if (ap(x) && o2a(x)[1] == 20) {
+            return node(g, NODE_VAR, x, 2);
+        }
+        U = node(g, NODE_CONST, x, 1);
+        o2a(U)[4] = x;
+        return U;
+    }
+    s = car(x);
+    i = ap(s) && o2a(s)[1] == 20 ? o2a(s)[7] >> 3 : 0;
+    switch (i) {
+    case 12:
+        U = node(g, NODE_CONST, x, 1);
+        wb(o2a(U) + 4, o2a(U)[4] = cadr(x));
+        return U;
+    case 19:
+        n = (nforms(cdr(x)) + 1) / 2;
+        U = node(g, NODE_SETQ, x, 3 * n);
+        for (i = 4, V = cdr(x); n--; i += 3, V = cddr(V)) {
+            wb(o2a(U) + i, o2a(U)[i] = car(V));
+            s = comp(g, cadr(V));
+            wb(o2a(U) + i + 2, o2a(U)[i + 2] = s);
+        }
+        return U;
+    case 28:
+        U = node(g, NODE_IF, x, 3);
+        for (i = 4, V = cdr(x); i < 7; i++, V = cdr(V)) {
+            s = comp(g, car(V));
+            wb(o2a(U) + i, o2a(U)[i] = s);
+        }
+        return U;
+    case 31:
+        n = nforms(cdr(x));
+        U = node(g, NODE_PROGN, x, n);
+        break;
+    case 109:
+        V = car(cddr(x));
+        if (nforms(cdr(x)) == 2 && cp(V) && car(V) == symi[12].sym) {
+            U = node(g, NODE_SLOT, x, 4);
+            V = cdr(x);
+            i = 6;
+            goto args;
+        }
+        goto call;
+    case 113:
+        V = car(cddr(x));
+        if (nforms(cdr(x)) >= 2 && sp(V) && o2s(V)[1] == LVAL_JREF_SIMPLE_STRING_SUBTYPE) {
+            U = l2(g, symi[114].sym, V);
+            U = cons(g, U, cdr(cddr(x)));
+            V = cons(g, cadr(x), U);
+            U = node(g, NODE_CALL, x, nforms(V) + 2);
+            i = 6;
+            goto args;
+        }
+        goto call;
+    default:
+        if (i > 11 && i < 34) {
+            U = node(g, NODE_SPECIAL, x, 1);
+            o2a(U)[4] = (i << 5) | 16;
+            return U;
+        }
+    call:
+        return node(g, NODE_CALL, x, nforms(cdr(x)) + 2);
+    }
+    V = cdr(x);
+    i = 4;
+args:
+    for (; cp(V); V = cdr(V), i++) {
+        s = comp(g, car(V));
+        wb(o2a(U) + i, o2a(U)[i] = s);
+    }
+    return U;
 }
 
-lval lclose_fs(lval* f) {
-    CloseHandle(o2s(f[1])[3]);
-    return 0;
-}
+lval run(lval*, lval);
 
-lval llisten_fs(lval* f) {
-    return WaitForSingleObject(o2s(f[1])[3], 0) == WAIT_OBJECT_0 ? TRUE : 0;
+/**
+ * Replaces the node c by the compiled copy of the macro expansion x.
+ */
+lval expand(lval* f, lval c, lval x) {
+    x = comp(f, copy_code(f, x));
+    wb(o2a(c) + 4, o2a(c)[4] = x);
+    o2a(c)[2] = (NODE_MACRO << 5) | 16;
+    return run(f, x);
 }
 
-lval lread_fs(lval* f) {
-    lint l = o2i(f[3]);
-    if (!ReadFile(o2s(f[1])[3],
-        o2z(f[2]) + l, (o2s(f[2])[0] >> 6) - 4 - l, &l, NULL))
-        return 0;
-    return d2o(f, l);
+lval run_const(lval* f, lval c) {
+    return o2a(c)[4];
 }
 
-lval lwrite_fs(lval* f) {
-    int l = o2i(f[3]);
-    if (!WriteFile(o2s(f[1])[3],
-        o2z(f[2]) + l, o2i(f[4]) - l, &l, NULL))
-        return 0;
-    return d2o(f, l);
+lval run_var(lval* f, lval c) {
+    lval s = o2a(c)[3];
+    lval* p = laddr(f, s, o2a(c) + 5, 0);
+    lval v;
+    int m;
+    if (!p) {
+        return expand(f, c, *binding(f, s, 0, &m));
+    }
+    v = *p;
+    if (v == 8) {
+        dbgr(f, 0, s, &v);
+    }
+    return v == -8 ? o2a(s)[4] : v;
 }
 
-lval lfinish_fs(lval* f) {
-    FlushFileBuffers(o2s(f[1])[3]);
-    return 0;
+lval run_call(lval* f, lval c) {
+    lval s = car(o2a(c)[3]);
+    lval fn = 8;
+    lval ex;
+    lval* g;
+    lval* p;
+    lint i;
+    lint n;
+    int m;
+    if (ap(s) && o2a(s)[1] == 20) {
+        p = laddr(f, s, o2a(c) + 5, 1);
+        if (!p) {
+            fn = *binding(f, s, 1, &m);
+            g = f + 1;
+            for (ex = cdr(o2a(c)[3]); ex; ex = cdr(ex)) {
+                *++g = car(ex);
+            }
+            return expand(f, c, call(f, fn, g - f - 1));
+        }
+        fn = *p;
+    }
+    while (fn == 8) {
+        if (dbgr(f, 1, s, &fn)) {
+            return fn;
+        }
+    }
+    n = o2a(c)[0] >> 8;
+    if (n > 4 && !o2a(c)[6]) {
+        f[1] = c;
+        for (i = 6, ex = cdr(o2a(c)[3]); cp(ex); ex = cdr(ex), i++) {
+            f[2] = ex;
+            ex = comp(f + 2, car(ex));
+            c = f[1];
+            wb(o2a(c) + i, o2a(c)[i] = ex);
+            ex = f[2];
+        }
+    }
+    g = f + 3;
+    f[1] = 0;
+    for (i = 6; i <= n + 1; i++, g++) {
+        g[-1] = ((g - f - 3) << 5) | 16;
+        *g = *f;
+        g[-1] = run(g, o2a(c)[i]);
+    }
+    return call(f, fn, g - f - 3);
 }
 
-lval lfasl(lval* f) {
-    HMODULE h;
-    FARPROC s;
-    h = LoadLibrary(o2z(f[1]));
-    s = GetProcAddress(h, "init");
-    return s(f);
+/**
+ * Reads the slot from the cached location when the object is an instance
+ * of the same class as before, see sloc, instead of calling slot-value.
+ */
+lval run_slot(lval* f, lval c) {
+    lval s = car(o2a(c)[3]);
+    lval* p = laddr(f, s, o2a(c) + 5, 1);
+    if (p != o2a(s) + 5 || *p == 8) {
+        return run_call(f, c);
+    }
+    f[1] = 0;
+    f[2] = 16;
+    f[3] = *f;
+    f[2] = run(f + 3, o2a(c)[6]);
+    xvalues = 8;
+    p = sloc(f[2], o2a(c)[4]);
+    if (p && *p != 8) {
+        return *p;
+    }
+    f[4] = c;
+    f[5] = f[2];
+    f[6] = o2a(o2a(c)[7])[4];
+    slearn(f + 4, 4);
+    c = f[4];
+    p = sloc(f[2], o2a(c)[4]);
+    if (p && *p != 8) {
+        return *p;
+    }
+    f[3] = o2a(o2a(c)[7])[4];
+    return call(f, o2a(symi[109].sym)[5], 2);
 }
 
-lval luname(lval* f) {
-    OSVERSIONINFO osvi;
-    osvi.dwOSVersionInfoSize = sizeof(OSVERSIONINFO);
-#pragma warning(suppress : 4996)    GetVersionEx(&osvi);
-    f[1] = cons(f + 1, strf(f + 1, osvi.szCSDVersion), 0);
-    f[1] = cons(f + 1, d2o(f + 1, osvi.dwBuildNumber), f[1]);
-    f[1] = cons(f + 1, d2o(f + 1, osvi.dwMinorVersion), f[1]);
-    return cons(f + 1, d2o(f, osvi.dwMajorVersion), f[1]);
+lval run_if(lval* f, lval c) {
+    return run(f, o2a(c)[run(f, o2a(c)[4]) ? 5 : 6]);
 }
 
-#else /* unix */
-
-lval lmake_fs(lval* f) {
-    int fd = open(o2z(f[1]), f[2] ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY, 0600);
-    return fd >= 0 ? ms(f, 4, 116, 1, fd, f[2], 0) : d2o(f, errno);
+lval run_progn(lval* f, lval c) {
+    lint i;
+    lint n = o2a(c)[0] >> 8;
+    NF(1) T = 0;
+    for (i = 4; i <= n + 1; i++) {
+        T = run(g, o2a(c)[i]);
+    }
+    return T;
 }
 
-lval lclose_fs(lval* f) {
-    close(o2s(f[1])[3]);
-    return 0;
+lval run_setq(lval* f, lval c) {
+    lval r = 0;
+    lval* p;
+    lint i;
+    lint n = o2a(c)[0] >> 8;
+    for (i = 4; i <= n + 1; i += 3) {
+        r = run(f, o2a(c)[i + 2]);
+        p = laddr(f, o2a(c)[i], o2a(c) + i + 1, 0);
+        if (!p) {
+            p = binding(f, o2a(c)[i], 0, 0);
+        }
+        wb(p, *p = r);
+    }
+    return r;
 }
 
-lval llisten_fs(lval* f) {
-    fd_set r;
-    struct timeval t;
-    t.tv_sec = 0;
-    t.tv_usec = 0;
-    FD_ZERO(&r);
-    FD_SET(o2s(f[1])[3], &r);
-    return select(o2s(f[1])[3] + 1, &r, NULL, NULL, &t) ? TRUE : 0;
+lval run_special(lval* f, lval c) {
+    return symi[o2a(c)[4] >> 5].fun(f, cdr(o2a(c)[3]));
 }
 
-lval lread_fs(lval* f) {
-    int l = o2i(f[3]);
-    l = read(o2s(f[1])[3], o2z(f[2]) + l,
-        (o2s(f[2])[0] >> 6) - 4 - l);
-    return l < 0 ? cons(f, errno, 0) : d2o(f, l);
+lval run_macro(lval* f, lval c) {
+    return run(f, o2a(c)[4]);
 }
 
-lval lwrite_fs(lval* f) {
-    int l = o2i(f[3]);
-    l = write(o2s(f[1])[3],
-        o2z(f[2]) + l, o2i(f[4]) - l);
-    return l < 0 ? cons(f, errno, 0) : d2o(f, l);
+lval(*runs[])(lval*, lval) = {
+    run_const, run_var, run_call, run_if, run_progn, run_setq, run_special, run_macro,
+    run_slot
+};
+
+lval run(lval* f, lval c) {
+    xvalues = 8;
+    return runs[o2a(c)[2] >> 5](f, c);
 }
 
-lval lfinish_fs(lval* f) {
-    fsync(o2s(f[1])[3]);
-    return 0;
+lval evca(lval* f, lval co) {
+    lval ex = car(co);
+    if (nodep(ex)) {
+        return run(f, ex);
+    }
+    if (cp(ex) || (ap(ex) && o2a(ex)[1] == 20)) {
+        ex = comp(f, ex);
+        set_car(co, ex);
+        return run(f, ex);
+    }
+    xvalues = 8;
+    return ex;
 }
 
-lval lfasl(lval* f) {
-    void* h;
-    lval(*s) ();
-    h = dlopen(o2z(f[1]), RTLD_NOW);
-    s = dlsym(h, "init");
-    return s(f);
+int rgetc(void) {
+    return !inp ? getc(ins) : inp < ine ? (unsigned char)*inp++ : EOF;
 }
 
-lval luname(lval* f) {
-    struct utsname un;
-    uname(&un);
-    f[1] = cons(f + 1, strf(f + 1, un.machine), 0);
-    f[1] = cons(f + 1, strf(f + 1, un.version), f[1]);
-    f[1] = cons(f + 1, strf(f + 1, un.release), f[1]);
-    return cons(f + 1, strf(f, un.sysname), f[1]);
+void rungetc(int c) {
+    if (!inp) {
+        ungetc(c, ins);
+    }
+    else if (c != EOF) {
+        inp--;
+    }
 }
-#endif
 
-FILE* ins;
+int getnws() {
+    int c;
+    do {
+        c = rgetc();
+        if (c == ';') {
+            c = rgetc();
+            if (c == ';') {
+                /* skip to the newline or EOF */
+                do {
+                    c = rgetc();
+                } while (c != '\n' && c != '\r' && c != EOF);
+                continue;
+            }
+            rungetc(c);
+            break;
+        }
+    } while (isspace(c));
+    return c;
+}
 
-void load(lval* f, char* s) {
+/**
+ * Reads the elements up to the closing parenthesis, appending each at the
+ * tail U of the list T.
+ */
+lval read_list(lval* f) {
+    int c;
     lval r;
-    FILE* oldins = ins;
-    ins = fopen(s, "r");
-    if (ins) {
-        do
-            r = eval(f, lread(f));
-        while (r != 8);
-        fclose(ins);
+    NF(2) T = 0;
+    while ((c = getnws()) != ')' && c != EOF) {
+        if (c == '.') {
+            r = lread(g);
+            getnws();
+            if (!T) {
+                return r;
+            }
+            set_cdr(U, r);
+            break;
+        }
+        rungetc(c);
+        r = lread(g);
+        r = cons(g, r, 0);
+        if (T) {
+            set_cdr(U, r);
+        }
+        else {
+            T = r;
+        }
+        U = r;
     }
-    ins = oldins;
+    return T;
 }
 
-lval lload(lval* f) {
-    load(f, o2z(f[1]));
-    return symi[1].sym;
+/**
+ * Hashes the characters of the string s a word at a time, multiplying and
+ * folding the high bits down after each word as wyhash does.
+ */
+uintptr_t hash(lval s) {
+    const char* z = o2z(s);
+    uint64_t n = o2s(s)[0] / 64 - 4;
+    uint64_t h = n * 0x9E3779B97F4A7C15ULL;
+    uint64_t w;
+    for (; n >= 8; n -= 8, z += 8) {
+        memcpy(&w, z, 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 29;
+    }
+    w = 0;
+    memcpy(&w, z, n);
+    h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    h *= 0x94D049BB133111EBULL;
+    return (uintptr_t)(h ^ h >> 29);
 }
 
-lval lstring_equal(lval* f) {
-    return string_equal(f[1], f[2]) ? TRUE : 0;
+lval lhash(lval* f) {
+    return (lval)(hash(f[1]) >> 6 << 5 | 16);
 }
 
-lval leval(lval* f, lval* h) {
-    f[-1] = h - f > 2 ? f[2] : 0;
-    return eval(f - 1, f[1]);
-}
+/**
+ * Hash tables. The table of a hash table is a simple vector of triples of
+ * the hash as a fixnum, the key and the value, and a triple is empty when
+ * its hash is nil. The number of triples is a power of two; a key is looked
+ * for from the triple of its hash to the next empty one, and removing a key
+ * moves the later keys of the run back instead of leaving a mark.
+ * </p>
+ * A table which is 3/4 full is replaced by one twice as big. The old table
+ * is kept and each access moves some of its runs to the new one, so that
+ * no access moves all of it. A key is in one of the two tables.
+ * </p>
+ * The hash table is [2] the count, [5] the test, [6] the test as a HT_
+ * fixnum or the hash function for the tests which are not hashed here, [7]
+ * the table, [8] the old table or nil, [9] the index of the next triple
+ * of the old table to move and [10] the value of moved when the keys were
+ * hashed. Keys are hashed by address unless the test looks into them, so
+ * an access after a move hashes all of them again.
+ */
+#define HT_EQ       (0)
+#define HT_EQL      (1)
+#define HT_EQUAL    (2)
+#define HT_STRING   (3)
+#define HT_EQUALP   (4)
 
-void psym(lval p, lval n) {
-    int i;
-    if (!p) {
-        printf("#:");
+/* triples of the old table moved by each access, at least */
+#define HT_MOVE     (16)
+
+uintptr_t heql(lval x) {
+    uintptr_t h = 0;
+    lint i;
+    double d;
+    if (sp(x) && o2s(x)[1] == LVAL_JREF_DOUBLE_SUBTYPE) {
+        d = *(double*)(o2s(x) + 2);
+        memcpy(&h, &d, sizeof(h) < sizeof(d) ? sizeof(h) : sizeof(d));
+        return h;
     }
-    else if (p != pkg) {
-        lval m = car(o2a(p)[2]);
-        for (i = 0; i < o2s(m)[0] / 64 - 4; i++) {
-            putchar(o2z(m)[i]);
+    if (bigp(x)) {
+        for (i = 0; i < (o2s(x)[2] < 0 ? -o2s(x)[2] : o2s(x)[2]); i++) {
+            h = h * 31 + ((limb*)(o2s(x) + 3))[i];
         }
-        putchar(':');
+        return h ^ o2s(x)[2];
     }
+    return x;
+}
 
-    for (i = 0; i < o2s(n)[0] / 64 - 4; i++) {
-        putchar(o2z(n)[i]);
+int eqlp(lval a, lval b) {
+    lint n;
+    if (a == b) {
+        return 1;
     }
+    if (!sp(a) || !sp(b) || o2s(a)[1] != o2s(b)[1]) {
+        return 0;
+    }
+    if (o2s(a)[1] == LVAL_JREF_DOUBLE_SUBTYPE) {
+        return o2d(a) == o2d(b);
+    }
+    n = o2s(a)[2] < 0 ? -o2s(a)[2] : o2s(a)[2];
+    return bigp(a) && o2s(a)[2] == o2s(b)[2]
+        && !memcmp(o2s(a) + 3, o2s(b) + 3, n * sizeof(limb));
 }
 
-void print(lval x) {
+/**
+ * The hash for EQUAL: conses by the first elements to depth d, simple
+ * strings by their characters and the other objects as for EQL.
+ */
+uintptr_t hequal(lval x, int d) {
+    uintptr_t h = 0;
     int i;
-    switch (x & 3) {
-    case 0:
-        if (x) {
-            if (x & 8) {
-                if (LVAL_AS_INT(x) < 256 && isgraph(LVAL_AS_INT(x))) {
-                    printf("#\\%c", x >> 5);
-                }
-                else {
-                    printf("#\\U+%lld", x >> 5);
-                }
-            }
-            else {
-                printf("%lld", x >> 5);
-            }
+    if (cp(x)) {
+        for (i = 0; d && cp(x) && i < 8; i++, x = cdr(x)) {
+            h = h * 31 + hequal(car(x), d - 1);
+        }
+        return d && !cp(x) ? h * 31 + hequal(x, 0) : h;
+    }
+    if (sp(x) && o2s(x)[1] == LVAL_JREF_SIMPLE_STRING_SUBTYPE) {
+        return hash(x);
+    }
+    return heql(x);
+}
+
+int equal(lval a, lval b) {
+    for (; cp(a) && cp(b); a = cdr(a), b = cdr(b)) {
+        if (!equal(car(a), car(b))) {
+            return 0;
+        }
+    }
+    return eqlp(a, b) || string_equal(a, b);
+}
+
+/**
+ * The hash for EQUALP: characters without case, numbers by value, so that
+ * 1 and 1.0 hash alike, conses as for EQUAL and instances by their class.
+ * Arrays hash by the characters among their first elements, as a string
+ * may be EQUALP to a vector of characters and a vector of numbers to a
+ * bit vector.
+ */
+uintptr_t hequalp(lval x, int d) {
+    uintptr_t h = 0;
+    lval c = 0;
+    lint i;
+    lint n;
+    double v;
+    if (cp(x)) {
+        for (i = 0; d && cp(x) && i < 8; i++, x = cdr(x)) {
+            h = h * 31 + hequalp(car(x), d - 1);
+        }
+        return d && !cp(x) ? h * 31 + hequalp(x, 0) : h;
+    }
+    if ((x & 31) == 24) {
+        return x >> 5 > 96 && x >> 5 < 123 ? (x >> 5) - 32 : x >> 5;
+    }
+    if (FIXP(x) || (sp(x) && (o2s(x)[1] == LVAL_JREF_DOUBLE_SUBTYPE || bigp(x)))) {
+        v = o2d(x) == 0 ? 0 : o2d(x);
+        memcpy(&h, &v, sizeof(h) < sizeof(v) ? sizeof(h) : sizeof(v));
+        return h;
+    }
+    if (ap(x)) {
+        c = o2a(x)[1];
+        if (ap(c)) {
+            return c;
+        }
+        if (c == LVAL_IREF_ARRAY_SUBTYPE) {
+            n = o2a(x)[2] >> 5;
+            x = o2a(x)[4];
+        }
+        else if (c == LVAL_IREF_SIMPLE_VECTOR_SUBTYPE) {
+            n = o2a(x)[0] >> 8;
         }
         else {
-            printf("nil");
+            return x;
         }
-        break;
-    case 1:
-        printf("(");
-        print(car(x));
-        for (x = cdr(x); cp(x); x = cdr(x)) {
-            printf(" ");
-            print(car(x));
+    }
+    else if (sp(x) && o2s(x)[1] == LVAL_JREF_SIMPLE_STRING_SUBTYPE) {
+        n = o2s(x)[0] / 64 - 4;
+    }
+    else {
+        return sp(x) ? 0 : x;
+    }
+    if (sp(x) && o2s(x)[1] == LVAL_JREF_SIMPLE_STRING_SUBTYPE) {
+        for (i = 0; i < n && i < 8; i++) {
+            h = h * 31 + hequalp((lval)(unsigned char)o2z(x)[i] << 5 | 24, 0);
         }
-        if (x) {
-            printf(" . ");
-            print(x);
+    }
+    else if (ap(x) && o2a(x)[1] == LVAL_IREF_SIMPLE_VECTOR_SUBTYPE) {
+        for (i = 0; i < n && i < 8; i++) {
+            c = o2a(x)[2 + i];
+            h = h * 31 + ((c & 31) == 24 ? hequalp(c, 0) : 0);
         }
-        printf(")");
-        break;
-    case 2:
-        switch (o2a(x)[1]) {
-        case 212:
-            printf("#<function ");
-            print(o2a(x)[6]);
-            printf(">");
-            break;
-        case 20:
-            psym(o2a(x)[9], o2a(x)[2]);
-            break;
-        case 116:
-            printf("#(");
-            for (i = 0; i < o2a(x)[0] >> 8; i++) {
-                if (i)
-                    printf(" ");
-                print(o2a(x)[i + 2]);
-            }
-            printf(")");
-            break;
-        case 180:
-            printf("#<package ");
-            print(car(o2a(x)[2]));
-            printf(">");
-            break;
+    }
+    return h;
+}
+
+/**
+ * The hash of the key k in the hash table t, as kept in its table.
+ * Calls the hash function of the other tests with the frame g.
+ */
+lval hkey(lval* g, lval t, lval k) {
+    lval x = o2a(t)[6];
+    uintptr_t h;
+    if (!FIXP(x)) {
+        g[2] = k;
+        x = call(g, x, 1);
+        h = FIXP(x) ? (uintptr_t)(x >> 5) : heql(x);
+    }
+    else if (x >> 5 == HT_EQ) {
+        h = k;
+    }
+    else if (x >> 5 == HT_EQL) {
+        h = heql(k);
+    }
+    else if (x >> 5 == HT_EQUAL) {
+        h = hequal(k, 4);
+    }
+    else if (x >> 5 == HT_EQUALP) {
+        h = hequalp(k, 4);
+    }
+    else {
+        h = sp(k) && o2s(k)[1] == LVAL_JREF_SIMPLE_STRING_SUBTYPE ? hash(k) : k;
+    }
+    h *= (uintptr_t)0x9E3779B97F4A7C15ULL;
+    h ^= h >> (sizeof(h) * 4);
+    return (lval)(h << 5 | 16);
+}
+
+int htest(lval* g, lval t, lval a, lval b) {
+    lval x = o2a(t)[6];
+    if (a == b) {
+        return 1;
+    }
+    if (!FIXP(x) || x >> 5 == HT_EQUALP) {
+        g[2] = a;
+        g[3] = b;
+        return call(g, o2a(t)[5], 2) != LVAL_NIL;
+    }
+    switch (x >> 5) {
+        case HT_EQ:
+            return 0;
+        case HT_EQL:
+            return eqlp(a, b);
+        case HT_EQUAL:
+            return equal(a, b);
         default:
-            if (ap(o2a(x)[1])) {
-                printf("#<");
-                print(o2a(o2a(o2a(x)[1] - 4)[2])[2]);
-                printf(">");
-            }
-            else {
-                printf("#(");
-                for (i = 0; i <= o2a(x)[0] >> 8; i++)
-                    print(o2a(x)[i + 1]);
-                printf(")");
-            }
-        } break;
-    case 3:
-        switch (o2s(x)[1]) {
-        case 20:
-            printf("\"");
-            for (i = 0; i < o2s(x)[0] / 64 - 4; i++) {
-                char c = o2z(x)[i];
-                printf((c == '\\' || c == '\"' ? "\\%c" : "%c"), c);
-            } printf("\"");
+            return string_equal(a, b);
+    }
+}
+
+lint hcap(lval v) {
+    return (o2a(v)[0] >> 8) / 3;
+}
+
+/**
+ * The index of the triple of the key k with the hash w in the table v, or
+ * of the empty triple which ends its run.
+ */
+lint hslot(lval* g, lval t, lval v, lval k, lval w) {
+    lint m = hcap(v) - 1;
+    lint i = (lint)((uintptr_t)w >> 5) & m;
+    lval* e;
+    for (;; i = (i + 1) & m) {
+        e = o2a(v) + 2 + 3 * i;
+        if (!e[0] || (e[0] == w && htest(g, t, e[1], k))) {
+            return i;
+        }
+    }
+}
+
+/* the index of the empty triple which ends the run of the hash w in v */
+lint hfree(lval v, lval w) {
+    lint m = hcap(v) - 1;
+    lint i = (lint)((uintptr_t)w >> 5) & m;
+    while (o2a(v)[2 + 3 * i]) {
+        i = (i + 1) & m;
+    }
+    return i;
+}
+
+/**
+ * Empties the triple i of the table v, moving back the keys after it in
+ * its run which could not be found past the hole.
+ */
+void hdel(lval v, lint i) {
+    lint m = hcap(v) - 1;
+    lint j = i;
+    lint k;
+    lval* a = o2a(v) + 2;
+    for (;;) {
+        j = (j + 1) & m;
+        if (!a[3 * j]) {
             break;
-        case 84:
-            printf("%g", o2d(x));
+        }
+        k = (lint)((uintptr_t)a[3 * j] >> 5) & m;
+        if (i <= j ? i < k && k <= j : i < k || k <= j) {
+            continue;
+        }
+        a[3 * i] = a[3 * j];
+        wb(a + 3 * i + 1, a[3 * i + 1] = a[3 * j + 1]);
+        wb(a + 3 * i + 2, a[3 * i + 2] = a[3 * j + 2]);
+        i = j;
+    }
+    a[3 * i] = a[3 * i + 1] = a[3 * i + 2] = LVAL_NIL;
+}
+
+/* puts a key known not to be in the table v into its triple i */
+void hset(lval v, lint i, lval w, lval k, lval x) {
+    lval* e = o2a(v) + 2 + 3 * i;
+    e[0] = w;
+    wb(e + 1, e[1] = k);
+    wb(e + 2, e[2] = x);
+}
+
+/**
+ * Moves the triples of the old table of t to its table, at least n of them
+ * and then up to an empty one, so that no key left behind is looked for
+ * through a moved triple.
+ */
+void hmove(lval t, lint n) {
+    lval o = o2a(t)[8];
+    lval v = o2a(t)[7];
+    lint c;
+    lint i;
+    lval* e;
+    if (!o) {
+        return;
+    }
+    c = hcap(o);
+    for (i = o2a(t)[9] >> 5; i < c && (n > 0 || o2a(o)[2 + 3 * i]); i++, n--) {
+        e = o2a(o) + 2 + 3 * i;
+        if (e[0]) {
+            hset(v, hfree(v, e[0]), e[0], e[1], e[2]);
+            e[0] = e[1] = e[2] = LVAL_NIL;
+        }
+    }
+    if (i < c) {
+        o2a(t)[9] = i << 5 | 16;
+    }
+    else {
+        o2a(t)[8] = LVAL_NIL;
+        o2a(t)[9] = 16;
+    }
+}
+
+/**
+ * Finds the key k with the hash w in the hash table t. Returns its table
+ * and the index of its triple in *i, or nil.
+ */
+lval hfind(lval* g, lval t, lval k, lval w, lint* i) {
+    lval v = o2a(t)[7];
+    *i = hslot(g, t, v, k, w);
+    if (o2a(v)[2 + 3 * *i]) {
+        return v;
+    }
+    v = o2a(t)[8];
+    if (v) {
+        *i = hslot(g, t, v, k, w);
+        if (o2a(v)[2 + 3 * *i]) {
+            return v;
         }
     }
+    return LVAL_NIL;
 }
 
-lval lprint(lval* f) {
-    print(f[1]);
+/* makes the table of t twice as big, its old table being empty */
+void hgrow(lval* g, lval t) {
+    lint n = 6 * hcap(o2a(t)[7]);
+    lval* v = ma0(g, n);
+    v[1] = LVAL_IREF_SIMPLE_VECTOR_SUBTYPE;
+    memset(v + 2, 0, n * sizeof(lval));
+    wb(o2a(t) + 8, o2a(t)[8] = o2a(t)[7]);
+    wb(o2a(t) + 7, o2a(t)[7] = a2o(v));
+    o2a(t)[9] = 16;
+}
+
+/**
+ * A simple vector of the keys and values of the hash table t, so that they
+ * can be gone through while the function called removes them.
+ */
+lval hsnap(lval* g, lval t) {
+    lval* r = ma0(g, 2 * (o2a(t)[2] >> 5));
+    lval v;
+    lval* e;
+    lint n = 2;
+    lint i;
+    int j;
+    r[1] = LVAL_IREF_SIMPLE_VECTOR_SUBTYPE;
+    for (j = 7; j < 9; j++) {
+        v = o2a(t)[j];
+        for (i = 0; v && i < hcap(v); i++) {
+            e = o2a(v) + 2 + 3 * i;
+            if (e[0]) {
+                r[n++] = e[1];
+                r[n++] = e[2];
+            }
+        }
+    }
+    return a2o(r);
+}
+
+/**
+ * Hashes the keys of t again, into a table of the same size, if objects
+ * were moved since they were hashed.
+ */
+void hrehash(lval* g, lval t) {
+    lint n;
+    lint i;
+    lval* v;
+    while (o2a(t)[10] != (moved << 5 | 16)) {
+        o2a(t)[10] = moved << 5 | 16;
+        if (!o2a(t)[2]) {
+            continue;
+        }
+        g[0] = hsnap(g, t);
+        n = 3 * hcap(o2a(t)[7]);
+        v = ma0(g + 1, n);
+        v[1] = LVAL_IREF_SIMPLE_VECTOR_SUBTYPE;
+        memset(v + 2, 0, n * sizeof(lval));
+        wb(o2a(t) + 7, o2a(t)[7] = a2o(v));
+        o2a(t)[8] = LVAL_NIL;
+        o2a(t)[9] = 16;
+        for (i = 0; i < o2a(g[0])[0] >> 8; i += 2) {
+            g[1] = hkey(g + 1, t, o2a(g[0])[2 + i]);
+            hset(o2a(t)[7], hfree(o2a(t)[7], g[1]), g[1], o2a(g[0])[2 + i],
+                o2a(g[0])[3 + i]);
+        }
+    }
+}
+
+lval lgethash(lval* f, lval* h) {
+    lint i;
+    lval w;
+    lval v;
+    hrehash(h, f[2]);
+    w = hkey(h, f[2], f[1]);
+    hmove(f[2], HT_MOVE);
+    v = hfind(h, f[2], f[1], w, &i);
+    h[1] = v ? o2a(v)[2 + 3 * i + 2] : h - f > 3 ? f[3] : LVAL_NIL;
+    return mvalues(l2(h + 2, h[1], v ? TRUE : LVAL_NIL));
+}
+
+lval lsetf_gethash(lval* f, lval* h) {
+    lint i;
+    lval w;
+    lval v;
+    if (4 * ((o2a(f[3])[2] >> 5) + 1) > 3 * hcap(o2a(f[3])[7])) {
+        hmove(f[3], hcap(o2a(f[3])[7]));
+        hgrow(h, f[3]);
+    }
+    hrehash(h, f[3]);
+    w = hkey(h, f[3], f[2]);
+    hmove(f[3], HT_MOVE);
+    v = hfind(h, f[3], f[2], w, &i);
+    if (v) {
+        wb(o2a(v) + 2 + 3 * i + 2, o2a(v)[2 + 3 * i + 2] = f[1]);
+        return f[1];
+    }
+    v = o2a(f[3])[7];
+    hset(v, hfree(v, w), w, f[2], f[1]);
+    o2a(f[3])[2] += 32;
     return f[1];
 }
 
-lval lexit(lval* f) {
-    lval x = f[1];
-    lint code = (0 == (x & 3)) ? x >> 5 : 0;
-    exit((int)code);
-    return 0;
+lval lremhash(lval* f, lval* h) {
+    lint i;
+    lval w;
+    lval v;
+    hrehash(h, f[2]);
+    w = hkey(h, f[2], f[1]);
+    hmove(f[2], HT_MOVE);
+    v = hfind(h, f[2], f[1], w, &i);
+    if (!v) {
+        return LVAL_NIL;
+    }
+    hdel(v, i);
+    o2a(f[2])[2] -= 32;
+    return TRUE;
 }
 
-static void print_with_desc(const char* what, lval v) {
-    printf("; %s ", what);
-    if (v != 8) {
-        print(v);
+lval lhash_table_entries(lval* f, lval* h) {
+    return hsnap(h, f[1]);
+}
+
+lval lmaphash(lval* f, lval* h) {
+    lint i;
+    h[0] = hsnap(h, f[2]);
+    for (i = 0; i < o2a(h[0])[0] >> 8; i += 2) {
+        h[2] = o2a(h[0])[2 + i];
+        h[3] = o2a(h[0])[3 + i];
+        call(h, f[1], 2);
     }
-    else {
-        printf("<UNBOUND>");
+    return LVAL_NIL;
+}
+
+lval lsxhash(lval* f) {
+    return (lval)(hequal(f[1], 4) >> 6 << 5 | 16);
+}
+
+/**
+ * Sorting, for sort and stable-sort. SORT-VECTOR sorts the slots of a
+ * simple vector in place by introsort, or by merge sort through a second
+ * vector when stable, and SORT-LIST merge sorts a list by relinking its
+ * conses.</p>
+ * f[2] is the predicate, f[3] the key or nil and f[4] the mode: SORT_FIX
+ * and SORT_STRING tell that the predicate is #'< or #'string< without a
+ * key, which are compared here if all the elements are fixnums or simple
+ * strings. The elements being compared are always in rooted slots, and
+ * g[0] holds the key of the second one while the key of the first is
+ * computed.
+ */
+#define SORT_CALL   (0)
+#define SORT_FIX    (1)
+#define SORT_STRING (2)
+#define SORT_SMALL  (16)
+
+int sless(lval* f, lval* g, lval a, lval b) {
+    lint m;
+    lint n;
+    int c;
+    switch (f[4] >> 5) {
+    case SORT_FIX:
+        return (lint)a < (lint)b;
+    case SORT_STRING:
+        m = o2s(a)[0] / 64 - 4;
+        n = o2s(b)[0] / 64 - 4;
+        c = memcmp(o2z(a), o2z(b), m < n ? m : n);
+        return c < 0 || (!c && m < n);
     }
-    printf("\n");
+    if (f[3]) {
+        g[2] = b;
+        g[0] = call(g, f[3], 1);
+        g[2] = a;
+        a = call(g, f[3], 1);
+        b = g[0];
+    }
+    g[2] = a;
+    g[3] = b;
+    return call(g, f[2], 2) != LVAL_NIL;
+}
+
+/* whether x can be compared in mode */
+int smode(lval* f, lval x) {
+    switch (f[4] >> 5) {
+    case SORT_FIX:
+        return FIXP(x);
+    case SORT_STRING:
+        return sp(x) && o2s(x)[1] == LVAL_JREF_SIMPLE_STRING_SUBTYPE;
+    }
+    return 1;
 }
 
-lval linspect(lval* f) {
-    lval x = f[0];
-    printf(";; The object is a ");
-    switch (x & 3) {
-    case 0:
-        if (x == 0) {
-            printf("NIL");
-        }
-        else if (x & 8) {
-            printf("CHAR");
+lval* svec(lval v) {
+    return o2a(v) + 2;
+}
+
+void sswap(lval v, lint i, lint j) {
+    lval* p = svec(v);
+    lval x = p[i];
+    wb(p + i, p[i] = p[j]);
+    wb(p + j, p[j] = x);
+}
+
+/* insertion sort of [lo, hi), stable, holding the element moved in h[1] */
+void sinsert(lval* f, lval* h, lval v, lint lo, lint hi) {
+    lint i;
+    lint j;
+    for (i = lo + 1; i < hi; i++) {
+        h[1] = svec(v)[i];
+        for (j = i; j > lo && sless(f, h + 2, h[1], svec(v)[j - 1]); j--) {
+            wb(svec(v) + j, svec(v)[j] = svec(v)[j - 1]);
         }
-        else {
-            printf("FIXNUM");
+        wb(svec(v) + j, svec(v)[j] = h[1]);
+    }
+}
+
+void ssift(lval* f, lval* h, lval v, lint lo, lint r, lint n) {
+    lint c;
+    while ((c = 2 * r + 1) < n) {
+        if (c + 1 < n
+            && sless(f, h + 2, svec(v)[lo + c], svec(v)[lo + c + 1])) {
+            c++;
         }
-        break;
-    case 1:
-        printf("CONS");
-        break;
-    case 2:
-        switch (o2a(x)[1]) {
-        case 212:
-            printf("FUNCTION");
-            break;
-        case 20:
-            printf("SYMBOL");
-            break;
-        case 116:
-            printf("ARRAY");
-            break;
-        case 180:
-            printf("PACKAGE");
+        if (!sless(f, h + 2, svec(v)[lo + r], svec(v)[lo + c])) {
             break;
-        default:
-            printf("UNKNOWN-IREF(%Id)", o2a(x)[1]);
         }
-        break;
-    case 3:
-        switch (o2s(x)[1]) {
-        case 20:
-            printf("SIMPLE-STRING");
-            break;
-        case 84:
-            printf("DOUBLE");
+        sswap(v, lo + r, lo + c);
+        r = c;
+    }
+}
+
+void sheap(lval* f, lval* h, lval v, lint lo, lint hi) {
+    lint n = hi - lo;
+    lint i;
+    for (i = n / 2 - 1; i >= 0; i--) {
+        ssift(f, h, v, lo, i, n);
+    }
+    for (i = n - 1; i > 0; i--) {
+        sswap(v, lo, lo + i);
+        ssift(f, h, v, lo, 0, i);
+    }
+}
+
+/* partitions [lo, hi) around the median of three, which ends up at the
+ * index returned */
+lint spart(lval* f, lval* h, lval v, lint lo, lint hi) {
+    lint m = lo + (hi - lo) / 2;
+    lint i = lo;
+    lint j = hi;
+    if (sless(f, h + 2, svec(v)[m], svec(v)[lo])) {
+        sswap(v, m, lo);
+    }
+    if (sless(f, h + 2, svec(v)[hi - 1], svec(v)[m])) {
+        sswap(v, hi - 1, m);
+        if (sless(f, h + 2, svec(v)[m], svec(v)[lo])) {
+            sswap(v, m, lo);
+        }
+    }
+    sswap(v, lo, m);
+    for (;;) {
+        do {
+            i++;
+        } while (i < hi && sless(f, h + 2, svec(v)[i], svec(v)[lo]));
+        do {
+            j--;
+        } while (j > lo && sless(f, h + 2, svec(v)[lo], svec(v)[j]));
+        if (i >= j) {
             break;
         }
+        sswap(v, i, j);
     }
-    printf(".\n");
-    if ((x & 3) == 2 && o2a(x)[1] == 20) {
-        /* symbol extra info */
-        print_with_desc("Name is", o2a(x)[2]);
-        print_with_desc("Package is", o2a(x)[9]);
-        print_with_desc("Value is", o2a(x)[4]);
-        print_with_desc("Function is", o2a(x)[5]);
-        print_with_desc("Macro is ", o2a(x)[6]);
+    sswap(v, lo, j);
+    return j;
+}
+
+void sintro(lval* f, lval* h, lval v, lint lo, lint hi, int d) {
+    lint p;
+    while (hi - lo > SORT_SMALL) {
+        if (!d--) {
+            sheap(f, h, v, lo, hi);
+            return;
+        }
+        p = spart(f, h, v, lo, hi);
+        if (p - lo < hi - p) {
+            sintro(f, h, v, lo, p, d);
+            lo = p + 1;
+        }
+        else {
+            sintro(f, h, v, p + 1, hi, d);
+            hi = p;
+        }
     }
-    return 0;
+    sinsert(f, h, v, lo, hi);
 }
 
-int ep(lval* g, lval expr) {
-    int i;
-    lval v = rvalues(g, eval(g, expr));
-    if (car(v) == 8) {
-        return 0;
+/* merges [lo, m) and [m, hi) of a into b */
+void smerge(lval* f, lval* h, lval a, lval b, lint lo, lint m, lint hi) {
+    lint i = lo;
+    lint j = m;
+    lint k = lo;
+    lval x;
+    while (k < hi) {
+        if (i < m && (j >= hi
+            || !sless(f, h + 2, svec(a)[j], svec(a)[i]))) {
+            x = svec(a)[i++];
+        }
+        else {
+            x = svec(a)[j++];
+        }
+        wb(svec(b) + k, svec(b)[k] = x);
+        k++;
     }
-    if (v) {
-        for (i = 0; v; v = cdr(v)) {
-            printf(";%d: ", i++);
-            print(car(v));
-            printf("\n");
+}
+
+/**
+ * (sort-vector vector predicate key mode stable) sorts vector in place;
+ * h[0] holds the second vector of a stable sort.
+ */
+lval lsort_vector(lval* f, lval* h) {
+    lval v = f[1];
+    lint n = o2a(v)[0] >> 8;
+    lint i;
+    lint w;
+    lval* t;
+    int d = 0;
+    h[0] = h[1] = LVAL_NIL;
+    for (i = 0; i < n && f[4] >> 5 != SORT_CALL; i++) {
+        if (!smode(f, svec(v)[i])) {
+            f[4] = SORT_CALL << 5 | 16;
         }
     }
-    else {
-        printf(";no values\n");
+    if (!f[5]) {
+        for (i = n; i; i >>= 1) {
+            d += 2;
+        }
+        sintro(f, h, v, 0, n, d);
+        return v;
     }
-    return 1;
+    for (i = 0; i < n; i += SORT_SMALL) {
+        sinsert(f, h, v, i, i + SORT_SMALL < n ? i + SORT_SMALL : n);
+    }
+    if (n <= SORT_SMALL) {
+        return v;
+    }
+    t = ma0(h, n);
+    t[1] = LVAL_IREF_SIMPLE_VECTOR_SUBTYPE;
+    memset(t + 2, 0, n * sizeof(lval));
+    h[0] = a2o(t);
+    for (w = SORT_SMALL; w < n; w *= 2) {
+        for (i = 0; i < n; i += 2 * w) {
+            smerge(f, h, v, h[0], i, i + w < n ? i + w : n,
+                i + 2 * w < n ? i + 2 * w : n);
+        }
+        h[1] = v;
+        v = h[0];
+        h[0] = h[1];
+    }
+    if (v != f[1]) {
+        for (i = 0; i < n; i++) {
+            wb(svec(f[1]) + i, svec(f[1])[i] = svec(v)[i]);
+        }
+    }
+    return f[1];
 }
 
-char* exmsg[] = {
-    "variable unbound",
-    "function unbound",
-    "array index out of bounds",
-    "go tag not bound",
-    "block name not bound",
-    "catch tag not dynamically bound",
-    "too many arguments",
-    "too few arguments",
-    "dynamic extent of block exited",
-    "dynamic extent of tagbody exited"
-};
+/* merges the lists h[3], earlier, and h[4] into h[2] */
+lval slmerge(lval* f, lval* h, lval a, lval b) {
+    lval t = LVAL_NIL;
+    lval x;
+    h[2] = LVAL_NIL;
+    h[3] = a;
+    h[4] = b;
+    while (h[3] && h[4]) {
+        if (sless(f, h + 5, car(h[4]), car(h[3]))) {
+            x = h[4];
+            h[4] = cdr(x);
+        }
+        else {
+            x = h[3];
+            h[3] = cdr(x);
+        }
+        if (t) {
+            set_cdr(t, x);
+        }
+        else {
+            h[2] = x;
+        }
+        t = x;
+    }
+    x = h[3] ? h[3] : h[4];
+    if (t) {
+        set_cdr(t, x);
+    }
+    else {
+        h[2] = x;
+    }
+    return h[2];
+}
 
-int dbgr(lval* f, int x, lval val, lval* vp) {
-    lval ex;
-    lint i;
-    lval* h = f;
-    lint l = 0;
-    NF(0) ex = o2a(symi[59].sym)[5];
-    if (ex != 8) {
-        h++;
-        *++h = d2o(f, x);
-        *++h = val;
-        ex = call(f, ex, h - f - 1);
-        longjmp(top_jmp, 1);
+/**
+ * (sort-list list predicate key mode) sorts list stably: each cons taken
+ * off h[1] is merged into the runs of h[0], its slot k holding nil or a
+ * sorted run of 2^k conses older than those of the slots below.
+ */
+lval lsort_list(lval* f, lval* h) {
+    lval* r;
+    lval x;
+    int k;
+    h[0] = h[1] = h[2] = h[3] = h[4] = LVAL_NIL;
+    for (x = f[1]; x && f[4] >> 5 != SORT_CALL; x = cdr(x)) {
+        if (!smode(f, car(x))) {
+            f[4] = SORT_CALL << 5 | 16;
+        }
     }
-    printf(";exception: %s ", exmsg[x]);
-    if (val)
-        print(val);
-    printf("\n;restarts:\n;[t]oplevel\n;[u]se <form> instead\n;[r]eturn <form> from function\n");
-    while (1) {
-        lval* j;
-        printf(";%Id> ", l);
-        ex = lread(g);
-        if (ex == 8)
-            longjmp(top_jmp, 1);
-        if (sp(ex) && o2s(ex)[1] == 84) {
-            for (h = f, l = i = o2i(ex); i; i--) {
-                if (!h[2])
-                    break;
-                h = o2a(h[2]);
-            }
+    r = ma0(h, 64);
+    r[1] = LVAL_IREF_SIMPLE_VECTOR_SUBTYPE;
+    memset(r + 2, 0, 64 * sizeof(lval));
+    h[0] = a2o(r);
+    h[1] = f[1];
+    while (h[1]) {
+        x = h[1];
+        h[1] = cdr(x);
+        set_cdr(x, LVAL_NIL);
+        for (k = 0; svec(h[0])[k]; k++) {
+            x = slmerge(f, h, svec(h[0])[k], x);
+            svec(h[0])[k] = LVAL_NIL;
         }
-        else if (ap(ex) && o2a(ex)[1] == 20) {
-            switch (o2z(o2a(ex)[2])[0]) {
-            case 'B':
-                printf(";backtrace:\n");
-                j = f;
-                for (i = 0; j; i++) {
-                    printf(";%Id: ", i);
-                    if (j[0] >> 5 == 4) {
-                        print(o2a(j[5])[6]);
-                        printf(" ");
-                        print(j[4]);
-                    } printf("\n");
-                    if (!j[2])
-                        break;
-                    j = o2a(j[2]);
-                } break;
-            case 'R':
-                *vp = eval(g, lread(g));
-                return 1;
-            case 'T':
-                longjmp(top_jmp, 1);
-            case 'U':
-                *vp = eval(g, lread(g));
-                return 0;
-            }
+        wb(svec(h[0]) + k, svec(h[0])[k] = x);
+    }
+    x = LVAL_NIL;
+    for (k = 0; k < 64; k++) {
+        if (svec(h[0])[k]) {
+            x = slmerge(f, h, svec(h[0])[k], x);
         }
-        else
-            ep(h, ex);
     }
+    return x;
 }
 
-lval evca(lval* f, lval co) {
-    lval ex = car(co);
-    lval x = ex;
-    int m;
+/**
+ * Package tables: the external and internal symbols of a package, [3] and
+ * [4], each a simple vector of the count and then pairs of the hash of the
+ * name as a fixnum and the symbol, empty when the hash is nil. The number
+ * of pairs is a power of two and a name is looked for from the pair of its
+ * hash on, as in hash tables; a table 3/4 full is replaced by one twice as
+ * big.
+ */
+#define PKG_PAIRS   (64)
 
-ag:
-    xvalues = 8;
+lval* pvec(lval* g, lint n) {
+    lval* r = ma0(g, 1 + 2 * n);
+    r[1] = LVAL_IREF_SIMPLE_VECTOR_SUBTYPE;
+    memset(r + 2, 0, (1 + 2 * n) * sizeof(lval));
+    return r;
+}
 
-    if (cp(ex)) {
-        lval fn = 8;
-        if (ap(car(ex)) && o2a(car(ex))[1] == 20) {
-            lint i = o2a(car(ex))[7] >> 3;
-            if (i > 11 && i < 34)
-                return symi[i].fun(f, cdr(ex));
-            fn = *binding(f, car(ex), 1, &m);
-            if (m) {
-                lval* g = f + 1;
-                for (ex = cdr(ex); ex; ex = cdr(ex))
-                    *++g = car(ex);
-                x = ex = call(f, fn, g - f - 1);
-                set_car(co, ex);
-                goto ag;
-            }
-        }
-    st:
-        if (fn == 8) {
-            if (dbgr(f, 1, car(ex), &fn))
-                return fn;
-            else
-                goto st;
-        }
-        ex = cdr(ex);
-        ex = call(f, fn, map_eval(f, ex));
-    }
-    else if (ap(ex) && o2a(ex)[1] == 20) {
-        ex = *binding(f, ex, 0, &m);
-        if (m) {
-            x = ex;
-            set_car(co, ex);
-            goto ag;
-        }
-        if (ex == 8) {
-            dbgr(f, 0, x, &ex);
-        }
-    }
-    return ex == -8 ? o2a(x)[4] : ex;
+lval mkv(lval* f) {
+    return a2o(pvec(f, PKG_PAIRS));
 }
 
-int getnws() {
-    int c;
-    do {
-        c = getc(ins);
-        if (c == ';') {
-            c = getc(ins);
-            if (c == ';') {
-                /* skip to the newline or EOF */
-                do {
-                    c = getc(ins);
-                } while (c != '\n' && c != '\r' && c != EOF);
-                continue;
-            }
-            ungetc(c, ins);
-            break;
-        }
-    } while (isspace(c));
-    return c;
+lint pcap(lval v) {
+    return ((o2a(v)[0] >> 8) - 1) / 2;
 }
 
-lval read_list(lval* f) {
-    int c;
-    NF(1) T = 0;
-    c = getnws();
-    if (c == ')')
-        return 0;
-    if (c == '.') {
-        lval r = lread(g);
-        getnws();
-        return r;
+lval pkey(lval s) {
+    return (lval)(hash(s) << 5 | 16);
+}
+
+/**
+ * The index of the pair of the name s with the hash w in the table v, or
+ * of the empty pair which ends its run.
+ */
+lint pslot(lval v, lval s, lval w) {
+    lint m = pcap(v) - 1;
+    lint i = (lint)((uintptr_t)w >> 5) & m;
+    lval* e;
+    for (;; i = (i + 1) & m) {
+        e = o2a(v) + 3 + 2 * i;
+        if (!e[0] || (e[0] == w && string_equal(o2a(e[1])[2], s))) {
+            return i;
+        }
     }
-    ungetc(c, ins);
-    T = lread(g);
-    return cons(g, T, read_list(g));
 }
 
-lval read_string_list(lval* g) {
-    int c = getc(ins);
-    if (c == '\"')
-        return 0;
-    if (c == '\\')
-        c = getc(ins);
-    return cons(g, (c << 5) | 24, read_string_list(g));
+lint pfree(lval v, lval w) {
+    lint m = pcap(v) - 1;
+    lint i = (lint)((uintptr_t)w >> 5) & m;
+    while (o2a(v)[3 + 2 * i]) {
+        i = (i + 1) & m;
+    }
+    return i;
 }
 
-uintptr_t hash(lval s) {
-    unsigned char* z = (unsigned char*)o2z(s);
-    uintptr_t i = 0, h = 0, g;
-    while (i < (uintptr_t) o2s(s)[0] / 64 - 4) {
-        h = (h << 4) + z[i++];
-        g = h & 0xf0000000;
-        if (g) {
-            h = h ^ (g >> 24) ^ g;
+/**
+ * Puts the symbol y, whose name is not in it, into the table k of the
+ * package p.
+ */
+void pput(lval* g, lval p, int k, lval y) {
+    lval w = pkey(o2a(y)[2]);
+    lval v = o2a(p)[k];
+    lval* r;
+    lval* e;
+    lint i;
+    lint j;
+    int c = gcrootc;
+    if (4 * ((o2a(v)[2] >> 5) + 1) > 3 * pcap(v)) {
+        if (gcrootc + 2 <= GC_ROOTS) {
+            gcroots[gcrootc++] = p;
+            gcroots[gcrootc++] = y;
         }
+        r = pvec(g, 2 * pcap(o2a(p)[k]));
+        gcrootc = c;
+        v = o2a(p)[k];
+        for (i = 0; i < pcap(v); i++) {
+            e = o2a(v) + 3 + 2 * i;
+            if (e[0]) {
+                j = 3 + 2 * pfree(a2o(r), e[0]);
+                r[j] = e[0];
+                wb(r + j + 1, r[j + 1] = e[1]);
+            }
+        }
+        r[2] = o2a(v)[2];
+        v = a2o(r);
+        wb(o2a(p) + k, o2a(p)[k] = v);
     }
-    return h;
+    e = o2a(v) + 3 + 2 * pfree(v, w);
+    e[0] = w;
+    wb(e + 1, e[1] = y);
+    o2a(v)[2] += 32;
 }
 
-lval lhash(lval* f) {
-    return d2o(f, hash(f[1]));
+/**
+ * Removes the pair i of the table v, moving back the names after it in its
+ * run which could not be found past the hole.
+ */
+void pdel(lval v, lint i) {
+    lint m = pcap(v) - 1;
+    lint j = i;
+    lint k;
+    lval* a = o2a(v) + 3;
+    for (;;) {
+        j = (j + 1) & m;
+        if (!a[2 * j]) {
+            break;
+        }
+        k = (lint)((uintptr_t)a[2 * j] >> 5) & m;
+        if (i <= j ? i < k && k <= j : i < k || k <= j) {
+            continue;
+        }
+        a[2 * i] = a[2 * j];
+        wb(a + 2 * i + 1, a[2 * i + 1] = a[2 * j + 1]);
+        i = j;
+    }
+    a[2 * i] = a[2 * i + 1] = LVAL_NIL;
+    o2a(v)[2] -= 32;
 }
 
 lval make_symbol(lval* g, lval p, lval s) {
-    int h = hash(s) % 1021;
+    lval w = pkey(s);
     int i = 3;
+    lval* e;
     lval m;
     for (; i < 5; i++) {
-        m = o2a(o2a(p)[i])[2 + h];
-        for (; m; m = cdr(m)) {
-            lval y = car(m);
-            if (string_equal(o2a(y)[2], s)) {
-                return o2a(y)[7] ? y : 0;
-            }
+        e = o2a(o2a(p)[i]) + 3 + 2 * pslot(o2a(p)[i], s, w);
+        if (e[0]) {
+            return o2a(e[1])[7] ? e[1] : 0;
         }
     }
     m = ma(g, 9, 20, s, 0, (lval)8, (lval)8, (lval)8, (lval)-8, (lval)16, p, LVAL_NIL);
     if (p == kwp) {
         o2a(m)[4] = m;
     }
-
-    o2a(o2a(p)[3])[2 + h] = cons(g, m, o2a(o2a(p)[3])[2 + h]);
+    pput(g, p, 3, m);
     return m;
 }
 
-lval read_symbol(lval* g) {
-    int c = getc(ins);
-    if (isspace(c) || c == ')' || c == EOF) {
-        if (c != EOF) {
+lval lpackage_get(lval* f) {
+    lval* e = o2a(o2a(f[1])[o2i(f[2])]);
+    e += 3 + 2 * pslot(a2o(e), f[3], pkey(f[3]));
+    return !e[0] ? cons(f, 0, 0) : o2a(e[1])[7] ? e[1] : 0;
+}
+
+lval lpackage_put(lval* f, lval* h) {
+    pput(h, f[1], (int)o2i(f[2]), f[3]);
+    return f[3];
+}
+
+lval lpackage_rem(lval* f) {
+    lval v = o2a(f[1])[o2i(f[2])];
+    lint i = pslot(v, f[3], pkey(f[3]));
+    if (o2a(v)[3 + 2 * i]) {
+        pdel(v, i);
+    }
+    return 0;
+}
+
+/**
+ * The list of the symbols in the table k of the package p.
+ */
+lval lpackage_symbols(lval* f, lval* h) {
+    lint i;
+    *h = 0;
+    for (i = 0; i < pcap(o2a(f[1])[o2i(f[2])]); i++) {
+        if (o2a(o2a(f[1])[o2i(f[2])])[3 + 2 * i]) {
+            *h = cons(h + 1, o2a(o2a(f[1])[o2i(f[2])])[4 + 2 * i], *h);
+        }
+    }
+    return *h;
+}
+
+/**
+ * Reads the rest of a string literal, or a symbol name if sym, into a
+ * string made at once: from a mapped file by slicing the mapping, else
+ * through a buffer.
+ */
+lval read_chars(lval* g, int sym) {
+    static char* b;
+    static lint m;
+    const char* q = inp;
+    const char* e;
+    int esc = inp && !sym;
+    lint n = 0;
+    lint i;
+    lval* r;
+    int c;
+    if (inp) {
+        for (; q < ine && (sym ? !isspace((unsigned char)*q) && *q != ')'
+            : *q != '"'); q++, n++) {
+            q += esc && *q == '\\' && q + 1 < ine;
+        }
+        e = inp;
+        inp = q + (!sym && q < ine);
+    }
+    else {
+        for (; (c = getc(ins)) != EOF && (sym ? !isspace(c) && c != ')'
+            : c != '"'); n++) {
+            if (!sym && c == '\\') {
+                c = getc(ins);
+            }
+            if (n == m) {
+                b = realloc(b, m = m ? 2 * m : 256);
+            }
+            b[n] = c;
+        }
+        if (sym && c != EOF) {
             ungetc(c, ins);
         }
-        return 0;
+        e = b;
+    }
+    r = ms0(g, n);
+    r[1] = 20;
+    for (i = 0; i < n; i++) {
+        c = *e++;
+        if (esc && c == '\\' && e < q) {
+            c = *e++;
+        }
+        ((char*)(r + 2))[i] = sym && c > 96 && c < 123 ? c - 32 : c;
+    }
+    ((char*)(r + 2))[n] = 0;
+    return s2o(r);
+}
+
+/**
+ * Reads digits with an optional fraction and exponent. Integers that fit
+ * are read exactly as fixnums, larger ones nine digits at a time into the
+ * limbs of a bignum, everything else as a double.
+ */
+lval read_number(lval* g) {
+    static char* b;
+    static lint m;
+    lint n = 0;
+    int x = 0;
+    int c = rgetc();
+    uint64_t v = 0;
+    lval r;
+    limb* t;
+    uint64_t k;
+    lint i;
+    lint j;
+    for (; isdigit(c) || c == '.' || (c | 32) == 'e'
+        || ((c == '-' || c == '+') && (b[n - 1] | 32) == 'e'); c = rgetc()) {
+        if (n + 1 >= m) {
+            b = realloc(b, m = m ? 2 * m : 64);
+        }
+        x |= !isdigit(c);
+        v = v * 10 + (c - '0');
+        b[n++] = c;
+    }
+    rungetc(c);
+    b[n] = 0;
+    if (!x && n < 18 && v <= INTPTR_MAX >> 5) {
+        r = (lval)v << 5 | 16;
+    }
+    else if (!x) {
+        t = calloc(n / 9 + 2, sizeof(limb));
+        for (i = 0; i < n; i += 9) {
+            for (v = 0, k = 1, j = i; j < n && j < i + 9; j++, k *= 10) {
+                v = v * 10 + b[j] - '0';
+            }
+            for (j = 0; j < n / 9 + 2; j++, v >>= 32) {
+                v += k * t[j];
+                t[j] = (limb)v;
+            }
+        }
+        r = bmake(g, t, n / 9 + 2, 0);
+        free(t);
     }
-    if (c > 96 && c < 123) {
-        c -= 32;
+    else {
+        r = d2o(g, strtod(b, NULL));
     }
-    return cons(g, (c << 5) | 24, read_symbol(g));
+    return r;
 }
 
 lval list2(lval* g, int a) {
@@ -1918,7 +5831,7 @@ lval lread(lval* g) {
     if (c == '(')
         return read_list(g);
     if (c == '\"')
-        return stringify(g, read_string_list(g));
+        return read_chars(g, 0);
     if (c == '\'')
         return list2(g, 12);
     if (c == '#') {
@@ -1936,20 +5849,18 @@ lval lread(lval* g) {
         if (c == '@') {
             return list2(g, 40);
         }
-        ungetc(c, ins);
+        rungetc(c);
         return list2(g, 39);
     }
-    ungetc(c, ins);
+    rungetc(c);
     if (isdigit(c)) {
-        double d;
-        fscanf(ins, "%lf", &d);
-        return d2o(g, d);
+        return read_number(g);
     }
 
     if (c == ':') {
         getnws();
     }
-    return make_symbol(g, c == ':' ? kwp : pkg, stringify(g, read_symbol(g)));
+    return make_symbol(g, c == ':' ? kwp : pkg, read_chars(g, 1));
 }
 
 lval strf(lval* f, const char* s) {
@@ -1961,21 +5872,137 @@ lval strf(lval* f, const char* s) {
     return s2o(str);
 }
 
-lval mkv(lval* f) {
-    int i = 2;
-    lval* r = ma0(f, 1021);
-    r[1] = 116;
-    while (i < 1023) {
-        r[i++] = 0;
-    }
-    return a2o(r);
-}
-
 lval mkp(lval* f, const char* s0, const char* s1) {
     return ma(f, 6, 180,
         l2(f, strf(f, s0), strf(f, s1)), mkv(f), mkv(f), 0, 0, 0);
 }
 
+/**
+ * Returns the package in *PACKAGES* with the name or nickname s, or nil.
+ */
+lval fpkg(const char* s) {
+    lval l;
+    lval n;
+    for (l = o2a(symi[81].sym)[4]; l; l = cdr(l)) {
+        for (n = o2a(car(l))[2]; n; n = cdr(n)) {
+            if (sp(car(n)) && !strcmp(o2z(car(n)), s)) {
+                return car(l);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Relocates word w of the constants of a unit: an offset from v, or from
+ * o with tag 3, or a class, symbol or package number with 1, 2 or 3 in
+ * bits 56 and up, looked up in t.
+ */
+lval frel(lval w, lval** t, lval* v, lval* o) {
+    if (!(w & 3)) {
+        return w;
+    }
+    if ((uintptr_t)w >> 56) {
+        return t[(uintptr_t)w >> 56][(w & (((lval)1 << 56) - 1)) >> 3];
+    }
+    return (w & 3) == 3 ? (lval)o + w : (lval)v + w;
+}
+
+/**
+ * Links a unit written by write-c, called by its init with its tables:
+ * the opaque offsets of its package names, the opaque offsets of its
+ * symbol names and the numbers of their packages (-1 for none), the
+ * symbol numbers of its class names, and its constants, value_data
+ * (conses and irefs) and opaque_data (jrefs). The tables get the
+ * objects, and the constants are copied into a segment of their own, as
+ * the code addresses them from *vp and *op.
+ */
+X void fasr(lval* f, lval* pk, lint pn, lval* sy, lval* sp, lint sn, lval* kl, lint kn,
+    lval* vd, lint vn, lval* od, lint on, lval** vp, lval** op) {
+    lint n = pn + sn + kn + (vn + on) / 2;
+    lval* t[4];
+    lval* r = ma0(f + 1, n);
+    lval* m;
+    lval* b;
+    lval x;
+    lint i;
+    lint j;
+    lint k;
+    r[1] = 116;
+    f[2] = a2o(r);
+    fasls = cons(f + 2, f[2], fasls);
+    for (i = 0; i < pn; i++) {
+        if (!(x = fpkg((char*)(od + pk[i] + 2)))) {
+            x = mkp(f + 2, (char*)(od + pk[i] + 2), "");
+            wb(o2a(symi[81].sym) + 4, o2a(symi[81].sym)[4] = cons(f + 2, x, o2a(symi[81].sym)[4]));
+        }
+        wb(o2a(f[2]) + 2 + i, o2a(f[2])[2 + i] = x);
+    }
+    for (i = 0; i < sn; i++) {
+        f[3] = strf(f + 2, (char*)(od + sy[i] + 2));
+        x = sp[i] < 0 ? ma(f + 3, 9, 20, f[3], 0, (lval)8, (lval)8, (lval)8, (lval)-8, (lval)16, 0, LVAL_NIL)
+            : make_symbol(f + 3, o2a(f[2])[2 + sp[i]], f[3]);
+        wb(o2a(f[2]) + 2 + pn + i, o2a(f[2])[2 + pn + i] = x);
+    }
+    x = kn ? make_symbol(f + 2, pkg, strf(f + 2, "FIND-CLASS")) : 0;
+    for (i = 0; i < kn && o2a(x)[5] != 8; i++) {
+        f[4] = o2a(f[2])[2 + pn + kl[i]];
+        f[4] = call(f + 2, x, 1);
+        wb(o2a(f[2]) + 2 + pn + sn + i, o2a(f[2])[2 + pn + sn + i] = f[4]);
+    }
+    gc(f + 2);
+    b = segs[mems].lo;
+    if (!(m = mseg(vn + on))) {
+        fprintf(stderr, "Out of memory");
+        exit(-1);
+    }
+    mems = (int)(sfind(b) - segs);
+    sfind(m)->pin = 1;
+    memcpy(m, vd, vn * sizeof(lval));
+    memcpy(m + vn, od, on * sizeof(lval));
+    r = o2a(f[2]);
+    t[1] = r + 2 + pn + sn;
+    t[2] = r + 2 + pn;
+    t[3] = r + 2;
+    k = 2 + pn + sn + kn;
+    for (b = m; b < m + vn + on; b += j) {
+        if (b >= m + vn) {
+            j = hsize(b);
+            x = (lval)b + 3;
+        }
+        else if (!(b[1] & 4)) {
+            j = 2;
+            b[0] = frel(b[0], t, m, m + vn);
+            b[1] = frel(b[1], t, m, m + vn);
+            x = (lval)b + 1;
+        }
+        else {
+            j = hsize(b);
+            if ((b[1] - 4) & 3) {
+                b[1] = frel(b[1] - 4, t, m, m + vn) + 4;
+            }
+            for (i = 0; i < b[0] >> 8; i++) {
+                b[i + 2] = frel(b[i + 2], t, m, m + vn);
+            }
+            x = (lval)b + 2;
+        }
+        b[0] |= 4;
+        wb(r + k, r[k] = x);
+        k++;
+    }
+    for (i = 0; i < pn; i++) {
+        pk[i] = r[2 + i];
+    }
+    for (i = 0; i < sn; i++) {
+        sy[i] = r[2 + pn + i];
+    }
+    for (i = 0; i < kn; i++) {
+        kl[i] = r[2 + pn + sn + i];
+    }
+    *vp = m;
+    *op = m + vn;
+}
+
 #ifdef _WIN32
 lval lrp(lval* f, lval* h)
 {
@@ -2008,6 +6035,8 @@ lval lrp(lval* f, lval* h) {
 }
 #endif
 
+lval lsave(lval* f);
+
 struct symbol_init symi[] = {
     {"NIL"}, {"T"}, {"&REST"}, {"&BODY"},
     {"&OPTIONAL"}, {"&KEY"}, {"&WHOLE"}, {"&ENVIRONMENT"}, {"&AUX"},
@@ -2032,9 +6061,9 @@ struct symbol_init symi[] = {
     {"/", ldivi, -2}, {"MAKE-FILE-STREAM", lmake_fs, 2}, {"HASH", lhash, 1},
     {"IERROR"}, {"GENSYM", lgensym, 0}, {"STRING", lstring, -1}, {"FASL", lfasl, 1},
     {"MAKEJ", lmakej, 2}, {"MAKEF", lmakef, 0}, {"FREF", lfref, 1},
-    {"PRINT", lprint, 1}, {"GC", gc, 0}, {"CLOSE-FILE-STREAM", lclose_fs, 1},
-    {"IVAL", lival, 1}, {"FLOOR", lfloor, -2}, {"READ-FILE-STREAM", lread_fs, 3},
-    {"WRITE-FILE-STREAM", lwrite_fs, 4}, {"LOAD", lload, 1},
+    {"PRINT", lprint, 1}, {"GC", lgc, -1}, {"CLOSE-FILE-STREAM", lclose_fs, 1},
+    {"IVAL", lival, 1}, {"FLOOR", lfloor, -2}, {"READ-FILE-STREAM", lread_fs, -4},
+    {"WRITE-FILE-STREAM", lwrite_fs, 4}, {"LOAD", lload, -2},
     {"IREF", liref, 2, setfiref, 3}, {"LAMBDA"}, {"CODE-CHAR", lcode_char, 1},
     {"CHAR-CODE", lchar_code, 1},
     {"*STANDARD-INPUT*"}, /* must be 78 */
@@ -2044,55 +6073,380 @@ struct symbol_init symi[] = {
     {"IMAKUNBOUND", limakunbound, 2}, {"EVAL", leval, -2}, {"JREF", ljref, 2, setfjref, 3},
     {"RUN-PROGRAM", lrp, -2}, {"UNAME", luname, 0},
     {"EXIT", lexit, 1}, {"QUIT", lexit, 1},
-    {"INSPECT", linspect, 1}
+    {"INSPECT", linspect, 1}, {"READ-LINE-FILE-STREAM", lreadl_fs, 1},
+    {"SAVE-IMAGE", lsave, 1}, {"GETHASH", lgethash, -3, lsetf_gethash, -4},
+    {"REMHASH", lremhash, 2}, {"MAPHASH", lmaphash, 2},
+    {"HASH-TABLE-ENTRIES", lhash_table_entries, 1}, {"SXHASH", lsxhash, 1},
+    {"MAKE-PACKAGE-TABLE", mkv, 0}, {"PACKAGE-GET", lpackage_get, 3},
+    {"PACKAGE-PUT", lpackage_put, 3}, {"PACKAGE-REM", lpackage_rem, 3},
+    {"PACKAGE-SYMBOLS", lpackage_symbols, 2},
+    {"SORT-VECTOR", lsort_vector, 5},
+    {"SORT-LIST", lsort_list, 4},
+    {"STRUCT-ACCESSOR", lstruct_accessor, 4},
+    {"GF-DISPATCHER", lgf_dispatcher, 2}, {"GF-CACHE-STORE", lgf_cache_store, 3},
+    {"GF-CACHE-FLUSH", lgf_cache_flush, 0},
+    {"SLOT-VALUE"}, /* must be 109 */
+    {"SLOT-LOCATION"}, /* must be 110 */
+    {"SLOT-READER", lslot_reader, 2}, {"SLOT-WRITER", lslot_writer, 2},
+    {"FORMAT"}, /* must be 113 */
+    {"FORMATTER"} /* must be 114 */
+};
+
+/**
+ * Sets the builtin symbols to their new addresses, see gccompact.
+ */
+void csyms() {
+    lint i;
+    for (i = 0; i < countof(symi); i++) {
+        croot(&symi[i].sym);
+    }
+}
+
+/**
+ * Heap image: the objects reachable from the packages and the builtin
+ * symbols, written by SAVE-IMAGE and restored by -i instead of loading
+ * the sources again.
+ * </p>
+ * The image is a header, the roots, a bitmap of the blocks which are
+ * jrefs (one bit per 2 words) and the blocks, from offset 0 in the order
+ * they were reached, without mark bits. A pointer is saved as its offset
+ * shifted by 3 and its tag. The C function of code is saved as its number
+ * in the table of infn and the builtins; the other jrefs are raw bytes.
+ */
+#define IMAGE_MAGIC     "L801IMG"
+
+struct image {
+    char magic[8];
+    lint lsize;
+    lint symc;
+    lint fsc;
+    lint moved;
+    lint n;
 };
 
+struct imap {
+    lval* k;
+    lint v;
+} *imap;
+lint imapn;
+lval* iq;
+lint iqc;
+lint iqn;
+lint iw;
+
+/* code that no builtin has */
+lval(*xfns[]) () = { lstruct_ref, lstruct_set, lgf_dispatch, lslot_read, lslot_write };
+
+#define IFN_MAX (2 * countof(symi) + countof(xfns))
+
+/**
+ * Function number k: infn, then the function and setf function of each
+ * builtin, then xfns.
+ */
+lval ifn(lint k) {
+    if (k > 2 * countof(symi)) {
+        return (lval)xfns[k - 2 * countof(symi) - 1];
+    }
+    return !k ? (lval)infn : k & 1 ? (lval)symi[k / 2].fun : (lval)symi[k / 2 - 1].setfun;
+}
+
+struct imap* islot(lval* t) {
+    lint i = ((uintptr_t)t >> 3) & (imapn - 1);
+    for (; imap[i].k && imap[i].k != t; i = (i + 1) & (imapn - 1));
+    return imap + i;
+}
+
+/**
+ * Returns the offset of object v in the image, queueing it if new.
+ */
+lint ioff(lval v) {
+    lval* t = (lval*)(v & ~3);
+    struct imap* e;
+    lint i;
+    if (iqc * 2 >= imapn) {
+        struct imap* o = imap;
+        lint n = imapn;
+        imapn = imapn ? imapn * 2 : 4096;
+        imap = calloc(imapn, sizeof(struct imap));
+        for (i = 0; i < n; i++) {
+            if (o[i].k) {
+                *islot(o[i].k) = o[i];
+            }
+        }
+        free(o);
+    }
+    if (!(e = islot(t))->k) {
+        if (iqc == iqn) {
+            iq = sgrow(iq, &iqn);
+        }
+        iq[iqc++] = v;
+        e->k = t;
+        e->v = iw;
+        iw += (v & 3) == 1 ? 2 : hsize(t);
+    }
+    return e->v;
+}
+
+lval ienc(lval v) {
+    return v & 3 ? ioff(v) << 3 | (v & 3) : v;
+}
+
+lval irel(lval* m, lval v) {
+    return v & 3 ? (lval)(m + (v >> 3)) | (v & 3) : v;
+}
+
+/**
+ * Writes the image file f[1], returns nil if an object can not be saved.
+ */
+lval lsave(lval* f) {
+    struct image h = { IMAGE_MAGIC, sizeof(lval), countof(symi), fsc, moved, 0 };
+    lval r[3 + countof(symi)];
+    lval* w = NULL;
+    unsigned char* b = NULL;
+    lval* t;
+    lval v;
+    lint i;
+    lint j;
+    lint k;
+    FILE* fp;
+    int ok = 1;
+    iqc = iw = 0;
+    r[0] = ienc(pkgs);
+    r[1] = ienc(pkg);
+    r[2] = ienc(kwp);
+    for (i = 0; i < countof(symi); i++) {
+        r[3 + i] = ienc(symi[i].sym);
+    }
+    for (i = 0; i < iqc; i++) {
+        t = (lval*)((v = iq[i]) & ~3);
+        if ((v & 3) == 1) {
+            ienc(t[0] & ~4);
+            ienc(t[1]);
+        }
+        else if ((v & 3) == 2) {
+            ienc(t[1] - 4);
+            for (j = 0; j < t[0] >> 8; j++) {
+                ienc(t[j + 2]);
+            }
+        }
+    }
+    h.n = iw;
+    w = malloc(iw * sizeof(lval));
+    b = calloc(iw / 16 + 1, 1);
+    for (i = 0; ok && w && b && i < iqc; i++) {
+        t = (lval*)((v = iq[i]) & ~3);
+        j = ioff(v);
+        if ((v & 3) == 1) {
+            w[j] = ienc(t[0] & ~4);
+            w[j + 1] = ienc(t[1]);
+            continue;
+        }
+        memcpy(w + j, t, hsize(t) * sizeof(lval));
+        w[j] &= ~4;
+        if ((v & 3) == 2) {
+            if ((t[1] - 4) & 3) {
+                w[j + 1] = ienc(t[1] - 4) + 4;
+            }
+            for (k = 0; k < t[0] >> 8; k++) {
+                w[j + k + 2] = ienc(t[k + 2]);
+            }
+            continue;
+        }
+        b[j >> 4] |= 1 << ((j >> 1) & 7);
+        if (t[1] == 212) {
+            for (k = 0; k <= IFN_MAX && ifn(k) != t[2]; k++);
+            ok = k <= IFN_MAX;
+            w[j + 2] = k;
+        }
+    }
+    ok = ok && w && b && (fp = fopen(o2z(f[1]), "wb"));
+    if (ok) {
+        ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(r, sizeof(r), 1, fp) == 1
+            && fwrite(b, iw / 16 + 1, 1, fp) == 1 && fwrite(w, sizeof(lval), iw, fp) == (size_t)iw;
+        ok = !fclose(fp) && ok;
+    }
+    free(w);
+    free(b);
+    free(imap);
+    imap = NULL;
+    imapn = 0;
+    return ok ? TRUE : 0;
+}
+
+/**
+ * Restores the image file s into a segment of its own, before the heap
+ * gets its first segments. The restored objects are old.
+ */
+void limage(const char* s) {
+    FILE* fp = fopen(s, "rb");
+    struct image h;
+    lval r[3 + countof(symi)];
+    unsigned char* b = NULL;
+    lval* m = NULL;
+    lval* t;
+    lint i;
+    lint k;
+    if (!fp || fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, IMAGE_MAGIC, 8)
+        || h.lsize != sizeof(lval) || h.symc != countof(symi)
+        || fread(r, sizeof(r), 1, fp) != 1 || !(b = malloc(h.n / 16 + 1))
+        || fread(b, h.n / 16 + 1, 1, fp) != 1 || !(m = mseg(h.n))
+        || fread(m, sizeof(lval), h.n, fp) != (size_t)h.n) {
+        fprintf(stderr, "Bad image %s", s);
+        exit(-1);
+    }
+    fclose(fp);
+    for (t = m; t < m + h.n; t += k) {
+        i = t - m;
+        if (b[i >> 4] & (1 << ((i >> 1) & 7))) {
+            k = hsize(t);
+            if (t[1] == 212) {
+                t[2] = ifn(t[2]);
+            }
+        }
+        else if (!(t[1] & 4)) {
+            k = 2;
+            t[0] = irel(m, t[0]);
+            t[1] = irel(m, t[1]);
+        }
+        else {
+            k = hsize(t);
+            if ((t[1] - 4) & 3) {
+                t[1] = irel(m, t[1] - 4) + 4;
+            }
+            for (i = 0; i < t[0] >> 8; i++) {
+                t[i + 2] = irel(m, t[i + 2]);
+            }
+        }
+        t[0] |= 4;
+    }
+    free(b);
+    pkgs = irel(m, r[0]);
+    pkg = irel(m, r[1]);
+    kwp = irel(m, r[2]);
+    for (i = 0; i < countof(symi); i++) {
+        symi[i].sym = irel(m, r[3 + i]);
+    }
+    fsinit(h.fsc);
+    moved = h.moved + 1;
+}
+
+/**
+ * Parses a size like 512k, 64m or 2g into bytes, keeping d if s is null.
+ */
+lint psize(const char* s, lint d) {
+    char* e;
+    lint n;
+    if (!s) {
+        return d;
+    }
+    n = strtoll(s, &e, 10);
+    switch (*e | 32) {
+    case 'g':
+        n *= 1024;
+        /* fall through */
+    case 'm':
+        n *= 1024;
+        /* fall through */
+    case 'k':
+        n *= 1024;
+    }
+    return n > 0 ? n : d;
+}
+
 int main(int argc, char* argv[]) {
-    int stack_size = 4 * 64 * 1024;
     lval* g;
     lint i;
+    int j;
     lval sym;
-    memory_size = 8 * 2048 * 1024;
-    memory = malloc(memory_size);
-    memf = memory;
-    memset(memory, 0, memory_size);
-    memf[0] = 0;
-    memf[1] = memory_size / 8;
-    stack = malloc(stack_size);
-    memset(stack, 0, stack_size);
-    g = stack + 5; /* TODO: constants for stack management */
-    pkg = mkp(g, "CL", "COMMON-LISP");
-    for (i = 0; i < countof(symi); i++) {
-        sym = make_symbol(g, pkg, strf(g, symi[i].name));
-        if (i == 0) {
-            o2a(sym)[4] = LVAL_NIL;
+    const char* image = getenv("LISP801_IMAGE");
+    memory_size = psize(getenv("LISP801_HEAP"), memory_size);
+    memory_max = psize(getenv("LISP801_HEAP_MAX"), memory_max);
+    stack_size = psize(getenv("LISP801_STACK"), stack_size);
+    gc_pause = psize(getenv("LISP801_GC_PAUSE"), gc_pause);
+    gc_threads = psize(getenv("LISP801_GC_THREADS"), gc_threads);
+    stream_buffer = psize(getenv("LISP801_STREAM_BUFFER"), stream_buffer);
+    /*
+     * -m initial heap, -M heap limit, -s stack, -p gc pause in microseconds,
+     * -t gc threads, -b file stream buffer, -i heap image to start from;
+     * the other args are loaded
+     */
+    for (i = j = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] == 'i' && !argv[i][2] && i + 1 < argc) {
+            image = argv[++i];
         }
-        else if (i < 10) {
-            o2a(sym)[4] = sym;
+        else if (argv[i][0] == '-' && strchr("mMsptb", argv[i][1]) && argv[i][1]
+            && !argv[i][2] && i + 1 < argc) {
+            lint* v = argv[i][1] == 's' ? &stack_size
+                : argv[i][1] == 'p' ? &gc_pause
+                : argv[i][1] == 't' ? &gc_threads
+                : argv[i][1] == 'b' ? &stream_buffer
+                : argv[i][1] == 'm' ? &memory_size : &memory_max;
+            *v = psize(argv[++i], *v);
         }
-        ins = stdin;
-        symi[i].sym = sym;
-        if (symi[i].fun) {
-            o2a(sym)[5] = ma(g, 5, 212, ms(g, 3, 212, symi[i].fun, LVAL_NIL, (lval)-1), LVAL_NIL, LVAL_NIL, LVAL_NIL, sym);
+        else {
+            argv[j++] = argv[i];
         }
-        if (symi[i].setfun) {
-            o2a(sym)[6] = ma(g, 5, 212, ms(g, 3, 212, symi[i].setfun, LVAL_NIL, (lval)-1), (lval)8, LVAL_NIL, LVAL_NIL, sym);
+    }
+    argc = j;
+#ifdef _WIN32
+    gc_threads = 1;
+#else
+    if (gc_threads > MARKERS_MAX) {
+        gc_threads = MARKERS_MAX;
+    }
+#endif
+    if (image) {
+        limage(image);
+    }
+    if (!mgrow(memory_size / sizeof(lval))) {
+        fprintf(stderr, "Out of memory");
+        exit(-1);
+    }
+    stack = malloc(stack_size);
+    memset(stack, 0, stack_size);
+    cstack = (char*)(&argc + 1);
+    g = stack + 5; /* TODO: constants for stack management */
+    ins = stdin;
+    if (!image) {
+        fsinit(0);
+        pkg = mkp(g, "CL", "COMMON-LISP");
+        for (i = 0; i < countof(symi); i++) {
+            sym = make_symbol(g, pkg, strf(g, symi[i].name));
+            if (i == 0) {
+                o2a(sym)[4] = LVAL_NIL;
+            }
+            else if (i < 10) {
+                o2a(sym)[4] = sym;
+            }
+            symi[i].sym = sym;
+            if (symi[i].fun) {
+                wb(o2a(sym) + 5, o2a(sym)[5] = ma(g, 5, 212, ms(g, 3, 212, symi[i].fun, LVAL_NIL, (lval)-1), LVAL_NIL, LVAL_NIL, LVAL_NIL, sym));
+            }
+            if (symi[i].setfun) {
+                wb(o2a(sym) + 6, o2a(sym)[6] = ma(g, 5, 212, ms(g, 3, 212, symi[i].setfun, LVAL_NIL, (lval)-1), (lval)8, LVAL_NIL, LVAL_NIL, sym));
+            }
+            o2a(sym)[7] = i << 3;
         }
-        o2a(sym)[7] = i << 3;
+        kwp = mkp(g, "KEYWORD", "");
+        wb(o2a(symi[81].sym) + 4, o2a(symi[81].sym)[4] = pkgs = l2(g, kwp, pkg));
     }
-    kwp = mkp(g, "KEYWORD", "");
-    o2a(symi[81].sym)[4] = pkgs = l2(g, kwp, pkg);
 #ifdef _WIN32
-    o2a(symi[78].sym)[4] = ms(g, 3, 116, (lval)1, GetStdHandle(STD_INPUT_HANDLE), LVAL_NIL, LVAL_NIL);
-    o2a(symi[79].sym)[4] = ms(g, 3, 116, (lval)1, GetStdHandle(STD_OUTPUT_HANDLE), TRUE, LVAL_NIL);
-    o2a(symi[80].sym)[4] = ms(g, 3, 116, (lval)1, GetStdHandle(STD_ERROR_HANDLE), TRUE, LVAL_NIL);
+    wb(o2a(symi[78].sym) + 4, o2a(symi[78].sym)[4] = ms(g, 4, 116, (lval)1, GetStdHandle(STD_INPUT_HANDLE), LVAL_NIL, (lval)0));
+    wb(o2a(symi[79].sym) + 4, o2a(symi[79].sym)[4] = ms(g, 4, 116, (lval)1, GetStdHandle(STD_OUTPUT_HANDLE), TRUE, (lval)1));
+    wb(o2a(symi[80].sym) + 4, o2a(symi[80].sym)[4] = ms(g, 4, 116, (lval)1, GetStdHandle(STD_ERROR_HANDLE), TRUE, (lval)2));
 #else
-    o2a(symi[78].sym)[4] = ms(g, 3, 116, (lval)1, LVAL_NIL, LVAL_NIL, LVAL_NIL);
-    o2a(symi[79].sym)[4] = ms(g, 3, 116, (lval)1, (lval)1, TRUE, LVAL_NIL);
-    o2a(symi[80].sym)[4] = ms(g, 3, 116, (lval)1, (lval)2, TRUE, LVAL_NIL);
+    if (stream_buffer && !isatty(0)) {
+        setvbuf(stdin, NULL, _IOFBF, stream_buffer);
+    }
+    if (stream_buffer && !isatty(1)) {
+        setvbuf(stdout, NULL, _IOFBF, stream_buffer);
+    }
+    wb(o2a(symi[78].sym) + 4, o2a(symi[78].sym)[4] = ms(g, 4, 116, (lval)1, LVAL_NIL, LVAL_NIL, (lval)0));
+    wb(o2a(symi[79].sym) + 4, o2a(symi[79].sym)[4] = ms(g, 4, 116, (lval)1, (lval)1, TRUE, (lval)1));
+    wb(o2a(symi[80].sym) + 4, o2a(symi[80].sym)[4] = ms(g, 4, 116, (lval)1, (lval)2, TRUE, (lval)2));
 #endif
     for (i = 1; i < argc; i++) {
-        load(g, argv[i]);
+        load(g, argv[i], 0);
     }
     setjmp(top_jmp);
     do {
@@ -354,6 +354,7 @@
     (3 (case (jref object 1)
 	 (20 'simple-string)
 	 (84 'double)
+	 (148 'bignum)
 	 (116 'simple-bit-vector)
 	 (t 'file-stream)))))
 (defmacro ecase (keyform &rest clauses)
@@ -400,8 +401,8 @@
   (or (eq a b)
       (and (= (ldb '(2 . 0) (ival a)) 3)
 	   (= (ldb '(2 . 0) (ival b)) 3)
-	   (= (jref a 1) 84)
-	   (= (jref b 1) 84)
+	   (= (jref a 1) (jref b 1))
+	   (or (= (jref a 1) 84) (= (jref a 1) 148))
 	   (= a b))))
 (defun equal (a b)
   (or (eql a b)
@@ -0,0 +1,25 @@
+(setq *failures* 0)
+(defun check (name value expected)
+  (if (eql value expected)
+      nil
+      (progn
+	(setq *failures* (+ *failures* 1))
+	(print (list 'fail name value expected)))))
+(defun protect-if (x)
+  (unwind-protect (if x 'then 'else) (setq x nil)))
+(check 'unwind-protect (unwind-protect 5 1 2) 5)
+(check 'unwind-protect-cleanup
+       (let ((y 0)) (unwind-protect 5 (setq y 6)) y) 6)
+(check 'unwind-protect-if-then (protect-if t) 'then)
+(check 'unwind-protect-if-else (protect-if nil) 'else)
+(check 'if-else (if nil 2 3) 3)
+(check 'if-then (if 1 2 3) 2)
+(check 'if-no-else (if nil 2) nil)
+(defmacro ignore-form (form) ''ignored)
+(setq *circle* (list 1 2))
+(setf (cdr (cdr *circle*)) *circle*)
+(defmacro ignore-circle () (list 'ignore-form *circle*))
+(defun use-ignore-circle () (ignore-circle))
+(check 'circular-macro-argument (eval (list 'ignore-form *circle*)) 'ignored)
+(check 'circular-macro-expansion (use-ignore-circle) 'ignored)
+(print (if (= *failures* 0) 'ok *failures*))
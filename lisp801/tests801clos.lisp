@@ -0,0 +1,37 @@
+(setq *failures* 0)
+(defun check (name value expected)
+  (if (eql value expected)
+      nil
+      (progn
+	(setq *failures* (+ *failures* 1))
+	(print (list 'fail name value expected)))))
+(defclass animal () ())
+(defclass dog (animal) ())
+(defclass cat (animal) ())
+(defmethod speak ((animal animal)) 'animal)
+(defmethod kind ((x t)) 't)
+(defmethod kind ((x integer)) 'integer)
+(defmethod kind ((x string)) 'string)
+(setq *dog* (make-instance 'dog))
+(check 'dispatch-miss (speak *dog*) 'animal)
+(check 'dispatch-hit (speak *dog*) 'animal)
+(defmethod speak ((dog dog)) 'dog)
+(check 'method-added (speak *dog*) 'dog)
+(check 'other-class (speak (make-instance 'cat)) 'animal)
+(defclass cat (dog) ())
+(setq *cat* (make-instance 'cat))
+(check 'class-redefined (speak *cat*) 'dog)
+(defmethod speak ((cat cat)) 'cat)
+(check 'method-added-after-redefinition (speak *cat*) 'cat)
+(check 'built-in-integer (kind 1) 'integer)
+(check 'built-in-string (kind "s") 'string)
+(check 'built-in-other (kind 'symbol) 't)
+(check 'built-in-nil (kind nil) 't)
+(gc :compact t)
+(check 'compacted-dog (speak *dog*) 'dog)
+(check 'compacted-cat (speak *cat*) 'cat)
+(check 'compacted-new (speak (make-instance 'dog)) 'dog)
+(check 'compacted-integer (kind 2) 'integer)
+(check 'compacted-string (kind "t") 'string)
+(check 'compacted-nil (kind nil) 't)
+(print (if (= *failures* 0) 'ok *failures*))